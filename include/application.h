@@ -3,6 +3,7 @@
 
 #include "query.h"
 #include "base_relation.h"
+#include "containment_map.h"
 
 #include <map>
 #include <unordered_map>
@@ -10,6 +11,8 @@
 #include <vector>
 #include <list>
 #include <string>
+#include <functional>
+#include <memory>
 
 class Application {
 public:
@@ -26,7 +29,35 @@ public:
 		double lb_cost() const; 
 	};
 private:
+	/**View tuples of the pool as parallel arrays indexed by a dense view tuple id, for the scans of 
+	the greedy optimizers. The view tuples of the index with id i have ids index_offsets[i] to 
+	index_offsets[i+1]-1, in the order in which index_to_query2vt lists them*/
+	struct ViewTupleStore {
+		std::vector<const Index*> indexes;  //!< by index id, in index_to_query2vt order
+		std::vector<const Query*> queries;  //!< by query id, in workload order
+		std::unordered_map<const Query*, uint> query_ids;
+		std::vector<double> query_weights;  //!< by query id
 
+		std::vector<uint> index_offsets;  //!< size is number of indexes + 1
+		std::vector<const ViewTuple*> vts;
+		std::vector<uint> query_id;
+		std::vector<double> cost_lb;  //!< weighted by the weight of the query
+		std::vector<double> cost_ub;  //!< weighted by the weight of the query
+		std::vector<esutils::BitSet> sc_goals;
+		std::vector<esutils::BitSet> wc_goals;
+		bool narrow;  //!< whether every query has at most esutils::max_mask_size goals
+		std::vector<uint64_t> sc_masks;  //!< sc_goals as single words if narrow
+		std::vector<uint64_t> wc_masks;  //!< wc_goals as single words if narrow
+
+		void build(const std::list<Query>& qs, 
+			const std::map<const Index*, std::map<const Query*, std::set<const ViewTuple*>>>& index_to_query2vt);
+		//!< number of goals in rem_goals covered by each view tuple of an index, by position in its row
+		void covered_counts(uint index, bool oe, const std::vector<esutils::BitSet>& rem_goals, 
+			std::vector<uint>& counts) const;
+	};
+	ViewTupleStore store;
+
+	std::shared_ptr<const SampleEstimator> sampler;  //!< if not null, storage costs and plan times are estimated over its samples
 	std::list<Query> queries;
 	std::list<Index> indexes;
 	std::list<ViewTuple> view_tuples_pool;
@@ -34,16 +65,25 @@ private:
 	std::map<const Query*, std::map<const Index*, std::set<const ViewTuple*>>> query_to_index2vt;
 	int max_num_goals_index;  //!< maximum number of goals in a candidate index's body
 	void generate_candidates();
+	uint prune_dominated_view_tuples();  //!< removes view tuples dominated by another one of the same index and query. Returns how many were removed
+	/**position in the row of an index of the view tuple with the least cost per newly covered goal. 
+	The first one wins ties, and any view tuple replaces one covering no new goals*/
+	static uint best_ratio(const std::vector<double>& costs, const std::vector<uint>& counts);
 
 	Design get_empty_design() const;
 	Design optimize_wsc(const Design& Dinit, bool oe) const;
-	std::set<const ViewTuple*> inner_greedy(const Index* index, uint& negc,
-		double& cost, const std::map<const Query*, std::set<uint>>& rem_goals, uint num_rem_goals,
-		const std::unordered_map<const Query*, Plan>& q2plan, bool oe) const;
-
-	std::set<const ViewTuple*> inner_greedy_standalone(const Index* index, uint& negc,
-		double& cost, const std::map<const Query*, std::set<uint>>& rem_goals, uint num_rem_goals,
-		bool oe) const;
+	/**greedily picks view tuples of an index covering goals in rem_goals at the least cost per goal. 
+	Costs are the times in the plans of q2plan or, if it is null, cost_ub if oe and cost_lb otherwise*/
+	std::set<const ViewTuple*> inner_greedy(uint index, uint& negc, double& cost, 
+		const std::vector<esutils::BitSet>& rem_goals, uint num_rem_goals,
+		const std::unordered_map<const Query*, Plan>* q2plan, bool oe) const;
+	void row_costs(uint index, bool oe, const std::unordered_map<const Query*, Plan>* q2plan, 
+		std::vector<double>& costs) const;  //!< costs of the view tuples of an index as used by inner_greedy
+	/**weighted set cover of rem_goals (by query id) starting with stored_indexes. Each view tuple 
+	picked is passed to add_vt. Returns the stored indexes*/
+	std::set<const Index*> greedy_cover(std::set<const Index*> stored_indexes, 
+		std::vector<esutils::BitSet> rem_goals, const std::unordered_map<const Query*, Plan>* q2plan, 
+		bool oe, std::function<void(const ViewTuple*)> add_vt) const;
 
 	double approx_factor;
 	double Lub;
@@ -61,14 +101,19 @@ public:
 	static double wt_storage;  //!< relative weight of storage cost w.r.t time cost
 	static uint pick_fn;  //!< 0->best LB, 1->best UB, 2->least remaining goals
 	static int branch_factor; //!< max number of designs to return when calling expand. If it is -1, return all designs 
+	static uint num_threads;  //!< threads used to generate view tuples. If it is 0, one per hardware thread
 
-	Application(const std::vector<Query>& workload, int k=3);
+	Application(const std::vector<Query>& workload, int k=3, 
+		std::shared_ptr<const SampleEstimator> sampler_arg=nullptr);
 	void show_candidates() const;
 
 	Design optimize();
 	Design optimize_wsc(bool oe);
 
 	Design optimize_wsc_standalone(bool oe);  //!< optimizes weighted set cover instance using greedy goal order
+
+	BitMatrix index_containment_matrix(uint num_threads=0) const;  //!< containment between every pair of candidate indexes, in candidate order
+	BitMatrix query_containment_matrix(uint num_threads=0) const;  //!< containment between every pair of workload queries, in workload order
 };
 
 #endif
\ No newline at end of file
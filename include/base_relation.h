@@ -3,6 +3,7 @@
 
 #include "data.h"
 #include "dataframe.h"
+#include "statistics.h"
 
 #include <vector>
 #include <set>
@@ -34,6 +35,9 @@ private:
 	std::string name;
 	std::vector<Column> columns; 
 	double numtups;
+	std::vector<ColumnStatistics> stats;  //!< empty unless the relation has been analyzed
+	double num_distinct_tuples = 0;  //!< 0 unless joint statistics were collected
+	std::map<std::pair<uint, uint>, double> pair_cards;  //!< distinct value pairs of every two columns, if collected
 public:
 	BaseRelation(const std::string& nm, const std::vector<Column>& cols, double numtuples);
 	int get_num_cols() const;
@@ -42,6 +46,18 @@ public:
 	Dtype dtype_at(int col) const;
 	double card_at(int col) const;
 	double num_tuples() const;
+
+	/**collects the statistics of the columns from the tuples of the relation in a single pass. The 
+	number of tuples and the column cardinalities are replaced by the ones observed, but never below 1. 
+	With joint, the distinct tuples and the distinct value pairs of every two columns are counted as well*/
+	void analyze(const std::vector<std::vector<Data>>& tuples, bool joint=false);
+	bool has_statistics() const;
+	const ColumnStatistics& statistics_at(int col) const;
+	double value_count(int col, const Data& dt) const;  //!< estimated number of tuples with the value dt in col
+	/**true if the number of distinct value combinations of the columns cols is known: for single 
+	columns, and for column pairs and all the columns if joint statistics were collected*/
+	bool has_joint_card(const std::set<int>& cols) const;
+	double joint_card(const std::set<int>& cols) const;
 	std::string show() const;
 
 private:
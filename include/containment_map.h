@@ -3,6 +3,14 @@
 
 #include "expression.h"
 #include <map>
+#include <atomic>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <cstdint>
 
 
 /** Map from variables of source expression to a target expression such that each goal of 
@@ -20,11 +28,100 @@ public:
 	ContainmentMap(const Expression* src, const Expression* dest, 
 		const std::map<int, Expression::Symbol>& var2var);
 	int goal_at(int gid) const; //!< maps the goal id in src expression to the mapped goal id in target expression
+	const std::map<int, Expression::Symbol>& var_map() const;  //!< maps each variable of src expression to a symbol of target expression
 	bool empty() const;
 	std::string show() const;
 };
 
+/**Number of checks rejected by each invariant filter (see Expression::Invariants) and number of 
+checks that had to fall back to backtracking search. Safe to update from multiple threads*/
+struct FilterCounters {
+	std::atomic<unsigned long> relations;
+	std::atomic<unsigned long> constants;
+	std::atomic<unsigned long> head_vars;
+	std::atomic<unsigned long> goal_patterns;
+	std::atomic<unsigned long> searches;
+	FilterCounters();
+	void reset();
+	std::string show() const;
+};
+
+FilterCounters& filter_counters();
+
+/**Thread-safe LRU cache of containment and isomorphism results keyed by the structural fingerprints 
+of the two expressions. Containment entries also store the variable mapping when store_mappings is 
+set; otherwise only negative containment results are cached. Concurrent peeks share the lock*/
+class ContainmentCache {
+public:
+	enum class Kind { Containment, Isomorphism };
+private:
+	struct Entry {
+		uint64_t key;
+		Kind kind;
+		std::string structure1;  //!< full structures guard against fingerprint collisions
+		std::string structure2;
+		bool result;
+		std::map<int, Expression::Symbol> var2symb;
+	};
+	std::list<Entry> entries;  //!< most recently used first
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> key2entry;
+	size_t capacity;
+	bool store_mappings;
+	uint64_t key_mask;  //!< bits of the keys that are kept
+	mutable std::shared_timed_mutex mtx;
+	std::atomic<unsigned long> num_hits;
+	std::atomic<unsigned long> num_misses;
+
+	uint64_t get_key(const Expression* exp1, const Expression* exp2, Kind kind) const;
+public:
+	/**keys are truncated to key_bits_arg bits. Fewer bits only make collisions of fingerprints more 
+	likely, which the cache resolves by comparing structures*/
+	ContainmentCache(size_t capacity_arg=1<<16, bool store_mappings_arg=true, uint key_bits_arg=64);
+	/**returns true on a hit and sets result and, for positive containment results, var2symb*/
+	bool lookup(const Expression* exp1, const Expression* exp2, Kind kind, 
+		bool& result, std::map<int, Expression::Symbol>& var2symb);
+	/**same as lookup but leaves the order of the entries and the counters untouched*/
+	bool peek(const Expression* exp1, const Expression* exp2, Kind kind, 
+		bool& result, std::map<int, Expression::Symbol>& var2symb) const;
+	void insert(const Expression* exp1, const Expression* exp2, Kind kind, 
+		bool result, const std::map<int, Expression::Symbol>& var2symb);
+	void set_capacity(size_t capacity_arg);  //!< 0 disables caching
+	void set_store_mappings(bool store);
+	void clear();  //!< drops all entries and resets the counters
+	size_t size() const;
+	unsigned long hits() const;
+	unsigned long misses() const;
+	double hit_rate() const;
+	std::string show() const;
+};
+
+ContainmentCache& containment_cache();  //!< cache used by find_containment_map and isomorphic
+
+bool goal_patterns_map(const Expression* src_exp, const Expression* dest_exp);  //!< false only if some goal of src_exp cannot be mapped to any goal of dest_exp irrespective of the head variables
+bool may_contain(const Expression* src_exp, const Expression* dest_exp);  //!< false only if there is certainly no containment map from src_exp to dest_exp
+bool may_be_isomorphic(const Expression* exp1, const Expression* exp2);  //!< false only if exp1 and exp2 are certainly not isomorphic
+
 ContainmentMap find_containment_map(const Expression* src_exp, const Expression* dest_exp);
+bool containment_map_exists(const Expression* src_exp, const Expression* dest_exp);  //!< same as find_containment_map without constructing the map
+
+/**Square bit matrix packed into 64 bit words, one row after the other*/
+class BitMatrix {
+	uint n;
+	uint words_per_row;
+	std::vector<uint64_t> words;
+public:
+	BitMatrix(uint n_arg);
+	bool at(uint row, uint col) const;
+	void set(uint row, uint col);
+	uint size() const;
+	uint count() const;  //!< number of set bits
+	std::string show() const;
+};
+
+/**Entry (i, j) is set if there is a containment map from exps[i] to exps[j]. Rows are distributed 
+dynamically over num_threads threads (0 to use all cores); every row is written by one thread so the 
+result does not depend on the schedule. The containment cache is peeked at but not filled*/
+BitMatrix containment_matrix(const std::vector<const Expression*>& exps, uint num_threads=0);
 
 bool isomorphic(const Expression* exp1, const Expression* exp2);
 
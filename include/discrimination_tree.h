@@ -0,0 +1,108 @@
+#ifndef DISCRIMINATION_TREE_H
+#define DISCRIMINATION_TREE_H
+
+#include "expression.h"
+#include "containment_map.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+/**Sorted keys of an expression's body used as its path in a DiscriminationTree: one key per 
+distinct relation and one per distinct constant*/
+std::vector<std::string> discrimination_keys(const Expression& exp);
+
+/**Trie over the relation and constant sets of stored expressions. A containment probe only walks 
+the branches labelled with keys of the probing expression, so it visits the stored expressions 
+whose relations and constants are subsets of the probe's instead of scanning all of them. 
+Values are returned in insertion order*/
+template <class T>
+class DiscriminationTree {
+	struct Node {
+		std::map<std::string, std::unique_ptr<Node>> children;
+		std::vector<std::pair<uint, T>> values;  //!< (insertion number, value)
+	};
+	struct Item {
+		const Expression* exp;
+		T value;
+	};
+	Node root;
+	std::vector<Item> items;
+
+	void collect_subsets(const Node& node, const std::vector<std::string>& keys, uint start,
+		std::vector<uint>& found) const {
+		for(auto& value: node.values)
+			found.push_back(value.first);
+		if(node.children.empty()) return;
+		for(uint i=start; i<keys.size(); i++) {
+			auto it = node.children.find(keys[i]);
+			if(it!=node.children.end())
+				collect_subsets(*(it->second), keys, i+1, found);
+		}
+	}
+
+	std::vector<T> values_at(std::vector<uint>& found) const {
+		std::sort(found.begin(), found.end());
+		std::vector<T> result;
+		for(auto id: found)
+			result.push_back(items[id].value);
+		return result;
+	}
+public:
+	/**exp must outlive the tree*/
+	void insert(const Expression* exp, const T& value) {
+		Node* node = &root;
+		for(const auto& key: discrimination_keys(*exp)) {
+			auto& child = node->children[key];
+			if(!child) child.reset(new Node());
+			node = child.get();
+		}
+		node->values.push_back(std::make_pair((uint) items.size(), value));
+		items.push_back(Item{exp, value});
+	}
+
+	/**values of the stored expressions whose body may be mapped into the body of exp, 
+	i.e. that may have a view tuple in a query with body exp*/
+	std::vector<T> find_mapping_into(const Expression& exp) const {
+		std::vector<uint> found, candidates;
+		collect_subsets(root, discrimination_keys(exp), 0, candidates);
+		for(auto id: candidates)
+			if(goal_patterns_map(items[id].exp, &exp))
+				found.push_back(id);
+		return values_at(found);
+	}
+
+	/**values of the stored expressions that pass may_contain(stored, exp)*/
+	std::vector<T> find_containing(const Expression& exp) const {
+		std::vector<uint> found, candidates;
+		collect_subsets(root, discrimination_keys(exp), 0, candidates);
+		for(auto id: candidates)
+			if(may_contain(items[id].exp, &exp))
+				found.push_back(id);
+		return values_at(found);
+	}
+
+	/**values of the stored expressions that pass may_be_isomorphic(stored, exp)*/
+	std::vector<T> find_isomorphic(const Expression& exp) const {
+		std::vector<uint> found;
+		const Node* node = &root;
+		for(const auto& key: discrimination_keys(exp)) {
+			auto it = node->children.find(key);
+			if(it==node->children.end()) return std::vector<T>();
+			node = it->second.get();
+		}
+		for(auto& value: node->values)
+			if(may_be_isomorphic(items[value.first].exp, &exp))
+				found.push_back(value.first);
+		return values_at(found);
+	}
+
+	uint size() const {
+		return items.size();
+	}
+};
+
+#endif
@@ -11,6 +11,7 @@
 #include <map>
 #include <set>
 #include <utility>
+#include <memory>
 
 
 /**Class to create and manipulate conjunctive expressions used in index definitions and queries.*/
@@ -32,14 +33,41 @@ public:
 		bool operator==(const Goal& goal) const;
 	};
 
+	/**Describes why an expression string could not be parsed*/
+	struct ParseError {
+		int line;  //!< position of the expression in a batch (line number for workload files), 0 otherwise
+		int pos;  //!< character offset of the error within the expression string, -1 if parsing succeeded
+		std::string message;
+		ParseError();
+		std::string show() const;
+	};
+
+	/**Properties of the body that every containment map has to preserve. They are used to reject 
+	containment and isomorphism checks before any backtracking. The signatures are 64 bit Bloom filters 
+	of the relation and constant sets, so a subset test on them is a single instruction*/
+	struct Invariants {
+		uint64_t relation_signature;
+		uint64_t constant_signature;
+		std::vector<const BaseRelation*> relations;  //!< sorted, without duplicates
+		std::vector<Data> constants;  //!< sorted, without duplicates
+		/**Distinct (relation, column pattern) pairs of the goals. pattern[i] is -1 if column i holds a 
+		constant and otherwise the first column of the goal holding the same variable*/
+		std::vector<std::pair<const BaseRelation*, std::vector<int>>> goal_patterns;
+		Invariants();
+	};
+
 	/**A dataframe associated to an expression*/
 	class Table {
 	public:
 		const Expression* exp;
 		DataFrame df;
 		std::map<int, std::string> headvar2cid;
+		std::map<int, std::string> var2cid;  //!< every variable if they are kept, the head variables otherwise
+		std::map<int, std::vector<std::string>> gid2extra_cids;  //!< columns carried along from the table of each goal
+		/**columns of the base relation tables beyond the ones of their relations are carried along. 
+		Unless keep_all_vars, variables that are not in the head are projected out*/
 		Table(const Expression* exp_arg, std::map<const BaseRelation*, 
-			const BaseRelation::Table*> br2table);
+			const BaseRelation::Table*> br2table, bool keep_all_vars=false);
 	private:
 		std::map<int, std::string> execute_goal(DataFrame& result,
 			const Expression* exp_arg, int gid, const BaseRelation::Table* table);
@@ -56,15 +84,41 @@ private:
 	std::set<int> allvars;
 	std::string sketch;
 	std::map<int, std::set<int>> var2goals; //!< maps a variable to the set of goals in which it appears
+	std::vector<uint64_t> goal_adjacency; //!< bitmask of goals sharing a variable with each goal. Empty if there are more than esutils::max_mask_size goals
 	std::string join_merge_sketch;
+	Invariants invars;
+	std::string structure;  //!< serialization of the goals and head variables, variable ids included
+	uint64_t fprint;  //!< hash of structure
+
+	void compute_fingerprint();
 
 	void compute_extrafeatures();
+	void compute_invariants();
 	void compute_sketch();
 	bool try_merge(const Expression& exp, esutils::oto_map<int, int>& g2g,
 		esutils::oto_map<int, int>& sv2sv) const;
 	int add_new_var(char code, Dtype dtp, std::string name); //!< 'h', 'f' for head or free
+	bool parse_into(const char* begin, const char* end, 
+		const std::map<std::string, const BaseRelation*>& name2br, ParseError& error);  //!< single pass parser over the characters in [begin, end)
 public:
-	Expression(std::string expr, const std::map<std::string, const BaseRelation*>& name2br);   //!< parse an expression from a string representation
+	Expression(const std::string& expr, const std::map<std::string, const BaseRelation*>& name2br);   //!< parse an expression from a string representation. Asserts that the string is well formed
+
+	/**Parses an expression without asserting. Returns an empty expression and fills error if the string is malformed*/
+	static Expression parse(const std::string& expr, 
+		const std::map<std::string, const BaseRelation*>& name2br, ParseError& error);
+	static Expression parse(const char* begin, const char* end, 
+		const std::map<std::string, const BaseRelation*>& name2br, ParseError& error);  //!< same as above over the characters in [begin, end)
+	/**Parses a batch of expression strings over num_threads threads (0 to use all cores). Returns the 
+	successfully parsed expressions in input order; errors are reported with line set to the index in exprs*/
+	static std::vector<Expression> parse_batch(const std::vector<std::string>& exprs,
+		const std::map<std::string, const BaseRelation*>& name2br, 
+		std::vector<ParseError>& errors, uint num_threads=0);
+	/**Parses a workload file with one expression per line. Empty lines and lines starting with '#' 
+	are skipped. Errors are reported with 1-based line numbers*/
+	static std::vector<Expression> parse_workload(const std::string& filename,
+		const std::map<std::string, const BaseRelation*>& name2br, 
+		std::vector<ParseError>& errors, uint num_threads=0);
+
 	std::string show() const;  //!< returns a string representation for debugging purposes
 	Expression subexpression(const std::set<int>& subset_goals) const;  //!< returns a subexpression made up of given subset of goals. It shares the variables with the original query
 	int num_goals() const;
@@ -76,7 +130,12 @@ public:
 	const std::string get_name() const;
 	const std::set<int>& goals_containing(int var) const;
 	bool connected(const std::set<int>& subset_goals) const; //!< returns true if the subset of goals are connected via joins
+	bool connected(uint64_t subset_goals) const; //!< same as above for a bitmask of goals. Requires num_goals() <= esutils::max_mask_size
+	esutils::ConnectedSubsets connected_subsets(uint max_size) const; //!< enumerates connected subsets of at most max_size goals. Requires num_goals() <= esutils::max_mask_size
 	const std::string& get_sketch() const;
+	const Invariants& invariants() const;
+	uint64_t fingerprint() const;  //!< structural hash. Expressions with equal structure() have the same goals and head variables up to the names of the variables
+	const std::string& get_structure() const;
 	void drop_headvar(int headvar); 
 	void make_headvar_bound(int headvar);
 	bool is_free_headvar(int var) const;
@@ -93,15 +152,87 @@ private:
 	Expression(); //!< creates an empty expression
 };
 
+/**Estimates cardinalities by executing expressions over samples of the base relations and scaling 
+the results up. A sample is a table holding uniformly drawn tuples of its relation in random order. 
+The samples are used in growing prefixes, doubling the rows every round while the next round is 
+expected to end within the time budget of the expression and the whole samples have not been used*/
+class SampleEstimator {
+public:
+	/**a scaled up count with the bounds of its confidence interval*/
+	struct Estimate {
+		double value;
+		double low;
+		double high;
+	};
+	/**result of an expression over the samples with all its variables*/
+	struct Result {
+		std::vector<std::vector<Data>> rows;
+		std::map<int, int> var2pos;
+		/**probability of each row to be in the sampled result, i.e. the product of the sampling 
+		fractions over the distinct base tuples it joins*/
+		std::vector<double> inclusion;
+		/**distinct base tuples joined by each row, as their relation and position in its sample, sorted*/
+		std::vector<std::vector<std::pair<const BaseRelation*, int>>> base_tuples;
+		std::map<const BaseRelation*, double> fractions;  //!< fraction of each relation that was sampled
+	};
+private:
+	std::map<const BaseRelation*, std::vector<std::vector<Data>>> br2sample;
+	double time_budget;
+	uint min_sample_tuples;
+public:
+	SampleEstimator(const std::map<const BaseRelation*, const BaseRelation::Table*>& br2table,
+		double time_budget_arg=0.05, uint min_sample_tuples_arg=50);  //!< time budget in seconds per expression
+	/**nullptr if a relation of exp has no sample or the goals of exp are not connected*/
+	std::shared_ptr<const Result> execute(const Expression& exp) const;
+	bool sparse(const Result& result) const;  //!< too few sampled tuples to scale up
+	/**Horvitz-Thompson estimate with a 95% confidence interval. Base tuples are taken as sampled 
+	independently, so rows sharing base tuples are correlated and the variance sums over every pair 
+	of rows sharing some. It takes time exponential in the number of goals*/
+	Estimate num_tuples(const Result& result) const;
+	/**distinct combinations of vars in the result by Shlosser's estimator. The interval ranges from the 
+	combinations seen to each combination seen once standing for 1/inclusion combinations*/
+	Estimate num_distinct(const Result& result, const std::vector<int>& vars) const;
+};
+
 class CardinalityEstimator {
 	Expression exp;
 	std::set<int> goals;  //!< which goals to consider while estimating cost
 	std::map<int, double> goal2selectivity;
 	std::map<int, double> var2card;
+	/**goals connected through shared variables, regardless of selections, with the products that 
+	give the fraction of a variable's values joining in the component when none of its variables 
+	is selected*/
+	struct Component {
+		std::vector<int> vars;
+		std::vector<int> goals;
+		esutils::LogFraction x;  //!< product of the selectivities of the goals
+		esutils::LogFraction n;  //!< product of the cardinalities of the variables
+		double factor = 1;  //!< 1-OneMinusXN(x, n)
+	};
+	std::map<int, int> var2parent;  //!< union-find over the variables of the considered goals
+	std::map<int, Component> root2component;
+	int find_root(int var) const;
+	/**for each variable, the product over the pieces its component falls into when it is the only 
+	selected variable of the component: first when it is the variable whose cardinality is estimated, 
+	then when it is another selected variable, which leaves out the goals holding no other variable. 
+	Built on first use, cleared by add_goal*/
+	mutable std::map<int, std::pair<double, double>> var2split_factors;
+	void compute_split_factors() const;
+	// cardinality of a variable given the variables selected before it, cleared by add_goal
+	mutable std::map<std::pair<int, esutils::BitSet>, double> memo;
+	mutable uint64_t memo_lookups = 0;
+	mutable uint64_t memo_hits = 0;
+	/**if not null and all the goals of the expression are considered, the expression is executed over 
+	its samples, falling back to the analytic estimate when the sampled result is too sparse*/
+	const SampleEstimator* sampler;
+	mutable std::shared_ptr<const SampleEstimator::Result> sample;  //!< built on first use, reset by add_goal
+	mutable bool sample_executed = false;
+	const SampleEstimator::Result* sample_result() const;  //!< nullptr if cardinalities are estimated analytically
+	double cardinality(int varid, const esutils::BitSet& selected_vars) const;
 public:
-	CardinalityEstimator(const Expression& exp_arg);  //!< considers all the goals
+	CardinalityEstimator(const Expression& exp_arg, const SampleEstimator* sampler_arg=nullptr);  //!< considers all the goals
 	CardinalityEstimator(const Expression& exp_arg,
-		const std::set<int>& goals_arg);
+		const std::set<int>& goals_arg, const SampleEstimator* sampler_arg=nullptr);
 	void add_goal(int gid);  
 	const std::set<int> considered_goals() const;
 	double var_card(int var) const;  //!< returns maximum cardinality of a given variable
@@ -114,7 +245,11 @@ public:
 	std::vector<double> get_cardinalities(const std::vector<int>& varids) const;
 	std::vector<double> get_cardinalities(const std::vector<int>& varids,
 		const std::set<int>& pre_select_vars) const;  //!< assume that selections are performed over select vars before computing cardinalities
+	//!< get_cardinalities memoizes its results, so it is not safe to call concurrently on the same estimator
+	uint64_t num_memo_lookups() const {return memo_lookups;}
+	uint64_t num_memo_hits() const {return memo_hits;}
 	const Expression& expression() const;
+	const SampleEstimator* sample_estimator() const {return sampler;}
 
 	double get_est_num_tuples() const;
 };
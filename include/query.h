@@ -4,11 +4,14 @@
 #include "expression.h"
 #include "data.h"
 #include "dataframe.h"
+#include "utils.h"
 
 #include <map>
 #include <string>
 #include <set>
 #include <list>
+#include <memory>
+#include <vector>
 
 class ViewTuple;
 
@@ -24,10 +27,14 @@ class Index {
 
 	double avg_disk_block_size;
 	double total_storage_cost;
+	std::vector<std::vector<uint>> head_perms;  //!< see head_permutations()
 public:
 	//Index& operator=(const Index& other);
-	Index(const Expression& exp_arg);
+	Index(const Expression& exp_arg, const SampleEstimator* sampler=nullptr);  //!< storage cost over the samples of sampler if given
 	const Expression& expression() const;
+	/**permutations of the positions of the head variables (in head_vars() order) by the automorphisms of 
+	the body that move a head variable. perm[i] is the position the i-th head variable is mapped to*/
+	const std::vector<std::vector<uint>>& head_permutations() const;
 	std::string show(bool verbose=true) const;
 	double storage_cost() const;
 	double avg_block_size() const;
@@ -36,18 +43,58 @@ public:
 
 /** Query */
 class Query {
+public:
+	/**one-to-one map of the symbols and goals of a body onto those of another body, mapping each goal 
+	onto a goal over the same relation. Constants map to equal constants and bound head, free head and 
+	non-head variables keep their roles. Automorphisms are isomorphisms of a body onto itself*/
+	struct Isomorphism {
+		std::vector<int> symbol_perm;  //!< image of each position of symbols
+		std::vector<int> goal_perm;  //!< image of each goal
+	};
+	static const uint max_automorphisms = 1000;  //!< at most this many automorphisms are enumerated
+
+	/**flat representation of a body used to enumerate containment maps and isomorphisms*/
+	struct Body {
+		std::vector<Expression::Symbol> symbols;  //!< distinct variables and constants of the body
+		std::vector<int> roles;  //!< 0 for constants, 1 for bound head, 2 for free head and 3 for other variables
+		std::map<int, int> var2sid;  //!< variable to its position in symbols
+		std::map<Data, int> const2sid;  //!< constant to its position in symbols
+		std::vector<std::vector<int>> goal_sids;  //!< symbol ids of the columns of each goal
+		std::vector<const BaseRelation*> goal_brs;  //!< relation of each goal
+		std::map<const BaseRelation*, std::vector<int>> br2goals;  //!< goals over each relation
+
+		Body(const Expression& exp);
+		int symbol_id(const Expression::Symbol& symbol) const;
+		/**at most max_count isomorphisms onto the body dest. Onto the body itself, all but the identity*/
+		std::vector<Isomorphism> isomorphisms(const Body& dest, uint max_count) const;
+	};
+private:
 	Expression exp;
-	std::map<Data, int> const2var;
-	std::list<BaseRelation::Table> tables;
-	std::map<const BaseRelation*, const BaseRelation::Table*> br2table;
+	Body body;
 
 	double wt;
 	std::vector<int> g_order;
+	std::string ckey;  //!< sorted descriptions of the goals with variables replaced by their roles
+
+	void add_view_tuples(std::list<ViewTuple>& result, const Index& index, 
+		const std::set<int>& projected_vars, const std::set<std::vector<int>>& images) const;
 public:
 	Query(const Expression& exp_arg, double wgt);
 	const std::vector<int>& goal_order() const;
 	const Expression& expression() const;
+	const std::string& class_key() const;  //!< equal for queries with isomorphic bodies
+	bool find_isomorphism(const Query& dest, Isomorphism& iso) const;  //!< returns false if the bodies are not isomorphic
+	int symbol_id(const Expression::Symbol& symbol) const;  //!< position of a symbol of the body in the flat representation
+	const Expression::Symbol& symbol_at(int sid) const;
+	/**one view tuple per distinct image of the index head variables over all containment maps from index 
+	to query, up to the head permutations of the index. Images that only differ by an automorphism of 
+	the index body give the same view tuple up to renaming the index variables*/
 	std::list<ViewTuple> get_view_tuples(const Index& index) const;
+	/**view tuples of each of indexes, aligned with it. Indexes with the same body are evaluated 
+	together once and the view tuples of each are projected from the common result. The number 
+	of distinct bodies is stored in num_bodies if given*/
+	std::vector<std::list<ViewTuple>> get_view_tuples(const std::vector<const Index*>& indexes, 
+		uint* num_bodies=nullptr) const;
 	std::string show(bool verbose=true) const; 
 	double weight() const; 
 };
@@ -58,31 +105,42 @@ public:
 	const Query& query;
 	const Index& index;
 	std::map<int, Expression::Symbol> index2query;  //!< index variables to query variables
-	std::set<std::set<int>> subcores;
+	std::set<esutils::BitSet> subcores;
 	double cost_lb = 0;  //!< lower bound
 	double cost_ub = 1e20; //!< upper bound
-	std::set<uint> sc_goals;  //!< strongly covered goals
-	std::set<uint> wc_goals;  //!< weakly covered goals
+	esutils::BitSet sc_goals;  //!< strongly covered goals
+	esutils::BitSet wc_goals;  //!< weakly covered goals
 
 	uint first_sc_goal_ind; //!< index of the first sc goal based on the goal order of the query
 
 	ViewTuple(const Query& query_arg,
 		const Index& index_arg,
 		std::map<int, Expression::Symbol> index2query_arg);
+	/**the view tuple of query_arg that other is mapped to by iso, an isomorphism from the body of 
+	other.query to the body of query_arg. Subcores and costs are carried over*/
+	ViewTuple(const ViewTuple& other, const Query& query_arg, const Query::Isomorphism& iso);
 	std::string show(bool verbose=true) const;
 
-	std::map<int, int> qvar2evar;
-	CardinalityEstimator E;
-
-	// same quantities but only considering the bound head variables
-	std::map<int, int> qvar2evar_bh;
-	CardinalityEstimator E_bh;
-
-	const std::set<uint>& covered_goals(bool oe) const;  //!< returns weakly or strongly covered goals
+	/**index expression with its head variables selected on the constants and joined on the query 
+	variables they map to (only bound head variables if bh), with a cardinality estimator over it 
+	using the samples of the index's estimator*/
+	struct Expansion {
+		std::map<int, int> qvar2evar;  //!< query variable to the variable of the expansion it maps to
+		CardinalityEstimator E;
+		Expansion(const ViewTuple& vt, bool bh);
+	};
+	// expansions are built on first access and shared by copies of the view tuple
+	const std::map<int, int>& get_qvar2evar() const {return expansion(false).qvar2evar;}
+	const CardinalityEstimator& get_estimator() const {return expansion(false).E;}
+	const std::map<int, int>& get_qvar2evar_bh() const {return expansion(true).qvar2evar;}
+	const CardinalityEstimator& get_estimator_bh() const {return expansion(true).E;}
+
+	const esutils::BitSet& covered_goals(bool oe) const;  //!< returns weakly or strongly covered goals
 private:
-
-	void try_match(bool& match, std::set<int>& subcore,
-		std::set<int>& unmapped_goals, std::map<int, int>& mu);
+	mutable std::shared_ptr<const Expansion> exp_all;
+	mutable std::shared_ptr<const Expansion> exp_bh;
+	const Expansion& expansion(bool bh) const;  //!< not safe to call concurrently before the expansion is built
+	void compute_coverage();  //!< sc_goals, wc_goals and first_sc_goal_ind from subcores
 };
 
 
@@ -92,19 +150,22 @@ class Plan {
 	std::set<const ViewTuple*> set_stages;
 	double cost=0;
 
-	std::set<uint> sc_goals;
-	std::set<uint> wc_goals;
+	esutils::BitSet sc_goals;
+	esutils::BitSet wc_goals;
 	bool complete=false;
 
 	CardinalityEstimator E;
 
-	bool check_completeness(std::set<int>& covered_goals,
-		std::vector<std::set<int>>& subcores, uint pos) const;
+	bool check_completeness(esutils::BitSet& covered_goals,
+		const std::vector<esutils::BitSet>& subcores, uint pos) const;
+	std::vector<std::set<int>> stage_pre_select_vars() const;  //!< variables of each stage's expansion on bound head variables
+	double time(const ViewTuple& vt, const std::vector<std::set<int>>& stage_selections) const;
 public:
-	Plan(const Query& qry);
+	Plan(const Query& qry, const SampleEstimator* sampler=nullptr);  //!< the query is estimated over the samples of sampler once covered
 	bool append(const ViewTuple& vt); 
 	double time(const ViewTuple& vt) const;
 	double time(const ViewTuple* vt) const; 
+	std::vector<double> time(const std::vector<const ViewTuple*>& vts) const;  //!< time of each view tuple, sharing the work on the plan
 	double current_cost() const;
 
 	bool iscomplete() const;
@@ -113,9 +174,9 @@ public:
 	uint num_stages() const;
 	bool has_vt(const ViewTuple* vt) const;
 
-	const std::set<uint>& strongly_covered_goals() const;
-	const std::set<uint>& weakly_covered_goals() const;
-	const std::set<uint>& covered_goals(bool oe) const;
+	const esutils::BitSet& strongly_covered_goals() const;
+	const esutils::BitSet& weakly_covered_goals() const;
+	const esutils::BitSet& covered_goals(bool oe) const;
 
 	int extra_sc_goals(const ViewTuple& vt) const; //!< returns how many extra strongly covered goals would be there if add vt tot he plan
 	int extra_wc_goals(const ViewTuple& vt) const;
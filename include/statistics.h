@@ -0,0 +1,77 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include "data.h"
+
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <cstdint>
+#include <random>
+
+
+uint64_t hash_data(const Data& dt);  //!< well mixed 64 bit hash of a cell
+uint64_t hash_combine(uint64_t hash1, uint64_t hash2);  //!< well mixed hash of a pair of hashes
+
+/**Sketch of the number of distinct values in a stream in 2^precision bytes. The standard error of
+estimate() is about 1.04/sqrt(2^precision), i.e. 1.6% for the default precision*/
+class HyperLogLog {
+	uint precision;
+	std::vector<uint8_t> registers;
+public:
+	HyperLogLog(uint precision_arg=12);
+	void add(uint64_t hash);
+	void merge(const HyperLogLog& other);  //!< sketch of the union of both streams. Precisions must be equal
+	double estimate() const;
+};
+
+/**Summary of the values of a column of a base relation*/
+struct ColumnStatistics {
+	/**Range of values between the upper bound of the previous bucket (exclusive) and upper (inclusive),
+	holding about the same number of tuples as every other bucket*/
+	struct Bucket {
+		Data upper;
+		double num_values;  //!< tuples with a value in the bucket
+		double num_distinct;  //!< distinct values in the bucket
+	};
+	double num_values = 0;  //!< tuples seen
+	double num_distinct = 0;
+	std::vector<std::pair<Data, double>> most_common;  //!< values with their number of tuples, most common first
+	std::vector<Bucket> histogram;  //!< equi-depth histogram, in increasing order of upper bounds
+	/**estimated number of tuples with the value dt: its count if it is one of the most common values,
+	and otherwise the average count of the distinct values of its bucket*/
+	double value_count(const Data& dt) const;
+	std::string show() const;
+};
+
+/**Collects the statistics of every column of a relation in a single pass over its tuples. Distinct
+counts come from HyperLogLog sketches, most common values from Space-Saving counters, and the
+histograms are built over a fixed size reservoir sample of each column. Optionally, distinct tuples 
+and distinct value pairs of every two columns are sketched in the same pass*/
+class StatisticsCollector {
+	struct ColumnState {
+		HyperLogLog hll;
+		std::map<Data, std::pair<double, double>> counters;  //!< Space-Saving: value to (count, overestimation)
+		std::set<std::pair<double, Data>> by_count;  //!< (count, value) of the counters, least counted first
+		std::vector<Data> sample;
+	};
+	uint num_mcvs;
+	uint num_buckets;
+	uint sample_size;
+	double num_tuples = 0;
+	std::vector<ColumnState> columns;
+	bool joint;  //!< whether distinct tuples and column pairs are tracked
+	HyperLogLog tuples_hll;
+	std::map<std::pair<uint, uint>, HyperLogLog> pair_hlls;
+	std::default_random_engine generator;
+public:
+	StatisticsCollector(uint num_cols, bool joint_arg=false, uint num_mcvs_arg=16, 
+		uint num_buckets_arg=32, uint sample_size_arg=4096);
+	void add_tuple(const std::vector<Data>& tuple);
+	std::vector<ColumnStatistics> statistics() const;
+	double num_distinct_tuples() const;  //!< 0 unless joint statistics are tracked
+	std::map<std::pair<uint, uint>, double> num_distinct_pairs() const;  //!< (col1, col2) with col1<col2 to the number of distinct value pairs
+};
+
+#endif
@@ -7,6 +7,10 @@
 #include <set>
 #include <map>
 #include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <cstddef>
 
 namespace esutils {
 
@@ -38,7 +42,93 @@ namespace esutils {
 	//!< generates all possible subsets of size k of the set {0, 1, ..., n-1}. k must be <= n
 	std::vector<std::set<int>> generate_subsets(uint n, uint k);
 
+	// bitmask representation of small sets of non-negative integers
+	const uint max_mask_size = 64;  //!< elements must be smaller than max_mask_size to be stored in a mask
+	uint64_t set_to_mask(const std::set<int>& s);
+	std::set<int> mask_to_set(uint64_t mask);
+	//!< same subsets in the same order as generate_subsets but as bitmasks. n must be <= max_mask_size
+	std::vector<uint64_t> generate_subset_masks(uint n, uint k);
+
+	/**Lazily enumerates every connected subset of at most max_size vertices of a graph with at most 
+	max_mask_size vertices exactly once (ESU algorithm). adjacency[v] is the bitmask of neighbours of v. 
+	Only connected subsets are ever visited, so the work is proportional to the number of results*/
+	class ConnectedSubsets {
+		struct Frame {
+			uint64_t subset;
+			uint64_t extension;  //!< vertices that may still be added to subset
+			uint64_t closed_nbrs;  //!< subset and all its neighbours
+		};
+		std::vector<uint64_t> adjacency;
+		uint max_size;
+		uint root;  //!< next vertex to start enumerating subsets from. Subsets never contain vertices smaller than their root
+		std::vector<Frame> stack;
+	public:
+		ConnectedSubsets(const std::vector<uint64_t>& adjacency_arg, uint max_size_arg);
+		bool next(uint64_t& subset);  //!< returns false once all subsets have been enumerated
+	};
+
+	/**Set of small non-negative integers such as goal ids stored as a bitmask. Elements smaller than 
+	max_mask_size live in a single word so that intersections and differences are a few AND, AND-NOT 
+	and popcount instructions; larger elements spill into further words. Iteration is in increasing 
+	order and operator< orders sets like std::set<std::set<uint>> does*/
+	class BitSet {
+		uint64_t low;
+		std::vector<uint64_t> high;  //!< elements max_mask_size and above. No trailing zero words
+
+		uint64_t word(uint i) const {return i==0 ? low : (i<=high.size() ? high[i-1] : 0);}
+		uint num_words() const {return 1+high.size();}
+		void trim();
+		bool any_above(uint ele) const;  //!< whether there is an element larger than ele
+	public:
+		class const_iterator {
+			const BitSet* bs;
+			uint wid;
+			uint64_t rest;  //!< bits of word wid not visited yet
+			void skip_empty();
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef uint value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const uint* pointer;
+			typedef uint reference;
+
+			const_iterator(const BitSet* bs_arg, uint wid_arg);
+			uint operator*() const {return wid*max_mask_size+__builtin_ctzll(rest);}
+			const_iterator& operator++() {rest &= rest-1; skip_empty(); return *this;}
+			bool operator==(const const_iterator& other) const {return wid==other.wid && rest==other.rest;}
+			bool operator!=(const const_iterator& other) const {return !(*this==other);}
+		};
+
+		BitSet(): low(0) {}
+		explicit BitSet(uint64_t mask): low(mask) {}
+		BitSet(std::initializer_list<uint> eles);
+
+		void insert(uint ele);
+		void erase(uint ele);
+		bool contains(uint ele) const;
+		uint size() const;
+		bool empty() const {return low==0 && high.empty();}
+		void clear() {low=0; high.clear();}
+		uint64_t mask() const {return low;}  //!< elements smaller than max_mask_size
+
+		uint intersection_size(const BitSet& other) const;
+		bool intersects(const BitSet& other) const;
+		BitSet& operator|=(const BitSet& other);
+		BitSet& operator&=(const BitSet& other);
+		BitSet& operator-=(const BitSet& other);  //!< set difference
+
+		bool operator==(const BitSet& other) const {return low==other.low && high==other.high;}
+		bool operator!=(const BitSet& other) const {return !(*this==other);}
+		bool operator<(const BitSet& other) const;
+
+		const_iterator begin() const {return const_iterator(this, 0);}
+		const_iterator end() const {return const_iterator(this, num_words());}
+	};
+
 	// set operations
+	uint set_intersection_size(const BitSet& s1, const BitSet& s2);
+	void set_difference_inplace(BitSet& s1, const BitSet& s2);
+	BitSet set_difference(const BitSet& s1, const BitSet& s2);
 	std::set<uint> set_intersection(const std::set<uint>& s1, const std::set<uint>& s2);
 	std::set<int> set_intersection(const std::set<int>& s1, const std::set<int>& s2);
 	std::set<uint> set_difference(const std::set<uint>& s1, const std::set<uint>& s2);
@@ -124,6 +214,31 @@ namespace esutils {
 	};
 
 	double OneMinusXN(const ExtremeFraction& x, const ExtremeFraction& n);
+
+	//!< same products as ExtremeFraction, kept as the natural log of the value so nothing is allocated
+	//!< eval() agrees with ExtremeFraction::eval() up to a relative error of about
+	//!< (number of factors) * 1e-16 * |log(value)|, below 1e-12 for the estimator's products,
+	//!< and OneMinusXN() up to an absolute error below 1e-12 for x in (0, 1]
+	class LogFraction {
+		double log_value;
+	public:
+		LogFraction(): log_value(0) {}
+		LogFraction(std::vector<double> nums, std::vector<double> dens);
+		void multiply(const LogFraction& lf) {
+			log_value += lf.log_value;
+		}
+		void multiply(double val);
+		void divide(const LogFraction& lf) {
+			log_value -= lf.log_value;
+		}
+		void divide(double val);
+		double log_eval() const {
+			return log_value;
+		}
+		double eval(double floor=1e-15, double ceil=1e20) const; //!< clamped to [floor, ceil] like ExtremeFraction::eval()
+	};
+
+	double OneMinusXN(const LogFraction& x, const LogFraction& n);
 }
 
 #endif
\ No newline at end of file
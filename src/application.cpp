@@ -5,6 +5,7 @@
 #include "containment_map.h"
 #include "expression.h"
 #include "base_relation.h"
+#include "discrimination_tree.h"
 
 #include <vector>
 #include <iostream>
@@ -19,14 +20,18 @@
 #include <cmath>
 #include <memory>
 #include <functional>
+#include <thread>
+#include <atomic>
 
 using std::function;
 using std::shared_ptr;
 using std::vector;
 using std::min;
+using std::max;
 using esutils::generate_subsets;
 using esutils::set_intersection_size;
 using esutils::set_difference_inplace;
+using esutils::BitSet;
 using esutils::set_difference;
 using std::cout;
 using std::endl;
@@ -47,9 +52,11 @@ double Application::max_vt_lb=1e20;
 double Application::wt_storage=0.001;
 int Application::branch_factor=-1;
 uint Application::pick_fn=0;
+uint Application::num_threads=0;
 
 
-Application::Application(const vector<Query>& workload, int k) {
+Application::Application(const vector<Query>& workload, int k, 
+		shared_ptr<const SampleEstimator> sampler_arg) : sampler(sampler_arg) {
 	for(auto& query: workload)
 		queries.push_back(query);
 	max_num_goals_index = k;
@@ -61,12 +68,38 @@ Application::Application(const vector<Query>& workload, int k) {
 }
 
 void Application::generate_candidates() {
-	// obtain complete plans for each query to estimate lower bound time estimates for view tuples
+	vector<const Query*> query_ptrs;
+	for(auto& query: queries)
+		query_ptrs.push_back(&query);
+
+	// queries whose bodies are isomorphic to that of an earlier query take its view tuples, mapped 
+	// through the isomorphism, so view tuples and the complete plans pricing them are generated once 
+	// per isomorphism class
+	vector<int> representative(query_ptrs.size(), -1);
+	vector<Query::Isomorphism> isos(query_ptrs.size());
+	vector<uint> rep_ids;
+	map<string, vector<uint>> key2reps;
+	for(uint qid=0; qid<query_ptrs.size(); qid++) {
+		auto& reps = key2reps[query_ptrs[qid]->class_key()];
+		for(auto rep: reps)
+			if(query_ptrs[rep]->find_isomorphism(*query_ptrs[qid], isos[qid])) {
+				representative[qid] = rep;
+				break;
+			}
+		if(representative[qid]<0) {
+			reps.push_back(qid);
+			rep_ids.push_back(qid);
+		}
+	}
+	cout<<query_ptrs.size()<<" queries in "<<rep_ids.size()<<" isomorphism classes\n";
+
+	// obtain complete plans for each representative query to estimate lower bound time estimates for view tuples
 	unordered_map<const Query*, Plan> complete_plans;
 	list<ViewTuple> complete_vts;
-	for(auto& query: queries) {
-		Index index(query.expression());
-		Plan P(query);
+	for(auto qid: rep_ids) {
+		const auto& query = *query_ptrs[qid];
+		Index index(query.expression(), sampler.get());
+		Plan P(query, sampler.get());
 		bool found_vt=false;
 		for(auto& vt: query.get_view_tuples(index)) {
 			int num_goals=0;
@@ -84,27 +117,31 @@ void Application::generate_candidates() {
 	}
 	cout<<"->1<-\n";
 
+	// candidates are indexed by their relations and constants so that duplicates are found by a probe
+	DiscriminationTree<const Index*> candidate_tree;
+	auto add_candidate = [&](const Expression& exp) {
+		for(auto index: candidate_tree.find_isomorphic(exp))
+			if(index->expression().get_sketch()==exp.get_sketch()
+				&& isomorphic(&index->expression(), &exp))
+				return;
+		indexes.push_back(Index(exp, sampler.get()));
+		candidate_tree.insert(&(indexes.back().expression()), &(indexes.back()));
+	};
+
 	// generate all subexpressions of every query to get an initial set of candidate index
 	for(auto& query: queries) {
-		for(int k=1; k<=max_num_goals_index && k<=query.expression().num_goals(); k++) {
-			for(auto& subset: generate_subsets(
-				query.expression().num_goals(), k)) {
-				if(query.expression().connected(subset)) {
-					Expression exp = query.expression().subexpression(subset);
-					bool match=false;
-					for(auto& index: indexes) {
-						if(index.expression().get_sketch()
-							==exp.get_sketch()) {
-							if(isomorphic(&index.expression(), &exp)) {
-								match = true;
-								break;
-							}
-						}
-					}
-					if(!match)
-						indexes.push_back(Index(exp));
-				}
-			}
+		const Expression& qexp = query.expression();
+		if(qexp.num_goals()<=(int) esutils::max_mask_size) {
+			auto subsets = qexp.connected_subsets(max(0, max_num_goals_index));
+			uint64_t subset;
+			while(subsets.next(subset))
+				add_candidate(qexp.subexpression(esutils::mask_to_set(subset)));
+		}
+		else {
+			for(int k=1; k<=max_num_goals_index && k<=qexp.num_goals(); k++)
+				for(auto& subset: generate_subsets(qexp.num_goals(), k))
+					if(qexp.connected(subset))
+						add_candidate(qexp.subexpression(subset));
 		}
 	}
 	cout<<"->2<-\n";
@@ -115,20 +152,8 @@ void Application::generate_candidates() {
 		for(auto it2=indexes.begin(); it2!=it; it2++) {
 			if(it->expression().get_join_merge_sketch()==it2->expression().get_join_merge_sketch()) {
 				Expression exp=it->expression().merge_with(it2->expression());
-				if(!exp.empty()) {
-					bool match=false;
-					for(auto& index: indexes) {
-						if(index.expression().get_sketch()
-							==exp.get_sketch()) {
-							if(isomorphic(&index.expression(), &exp)) {
-								match = true;
-								break;
-							}
-						}
-					}
-					if(!match)
-						indexes.push_back(Index(exp));
-				}
+				if(!exp.empty())
+					add_candidate(exp);
 			}
 		}
 		it++;
@@ -147,18 +172,7 @@ void Application::generate_candidates() {
 				Expression expr=index->expression();
 				for(auto i: subset)
 					expr.drop_headvar(head_vars[i]);
-				bool match=false;
-				for(auto& some_index: indexes) {
-					if(some_index.expression().get_sketch()
-						==expr.get_sketch()) {
-						if(isomorphic(&some_index.expression(), &expr)) {
-							match = true;
-							break;
-						}
-					}
-				}
-				if(!match)
-					indexes.push_back(Index(expr));
+				add_candidate(expr);
 			}
 		}
 	}
@@ -176,18 +190,7 @@ void Application::generate_candidates() {
 				Expression expr=index->expression();
 				for(auto i: subset)
 					expr.make_headvar_bound(head_vars[i]);
-				bool match=false;
-				for(auto& some_index: indexes) {
-					if(some_index.expression().get_sketch()
-						==expr.get_sketch()) {
-						if(isomorphic(&some_index.expression(), &expr)) {
-							match = true;
-							break;
-						}
-					}
-				}
-				if(!match)
-					indexes.push_back(Index(expr));
+				add_candidate(expr);
 			}
 		}
 	}
@@ -201,25 +204,57 @@ void Application::generate_candidates() {
 	for(auto it: indexes_to_delete)
 		indexes.erase(it);
 
-	// generate view tuples for all the candidates index generated 
-	for(auto& query: queries) {
-		for(auto& index: indexes) {
-			for(auto& vt: query.get_view_tuples(index)) {
-				vt.cost_lb = complete_plans.at(&query).time(vt);
-				if(vt.cost_lb<max_vt_lb) {
-					view_tuples_pool.push_back(vt);
-					if(index_to_query2vt.find(&index)==index_to_query2vt.end())
-						index_to_query2vt[&index] = {};
-					if(index_to_query2vt[&index].find(&query)==index_to_query2vt[&index].end())
-						index_to_query2vt[&index][&query] = {};
-					index_to_query2vt[&index][&query].insert(&(view_tuples_pool.back()));
-
-					if(query_to_index2vt.find(&query)==query_to_index2vt.end())
-						query_to_index2vt[&query] = {};
-					if(query_to_index2vt[&query].find(&index)==query_to_index2vt[&query].end())
-						query_to_index2vt[&query][&index] = {};
-					query_to_index2vt[&query][&index].insert(&(view_tuples_pool.back()));
+	// generate view tuples for all the candidates index generated. Only candidates whose body 
+	// may map into the query's body are tried, and candidates sharing a body are evaluated together.
+	// Queries are handed out to threads one at a time and each fills its own buffer, which are 
+	// merged in query order afterwards so that the result does not depend on the scheduling
+	DiscriminationTree<const Index*> remaining_candidates;
+	for(auto& index: indexes)
+		remaining_candidates.insert(&(index.expression()), &index);
+
+	vector<vector<pair<const Index*, list<ViewTuple>>>> query_buffers(query_ptrs.size());
+	std::atomic<uint> next_query(0);
+	auto fill_buffers = [&]() {
+		for(uint k=next_query++; k<rep_ids.size(); k=next_query++) {
+			uint qid = rep_ids[k];
+			const auto& query = *query_ptrs[qid];
+			const auto& complete_plan = complete_plans.at(&query);
+			auto query_candidates = remaining_candidates.find_mapping_into(query.expression());
+			auto query_vts = query.get_view_tuples(query_candidates);
+			for(uint i=0; i<query_candidates.size(); i++) {
+				vector<const ViewTuple*> vt_ptrs;
+				for(auto& vt: query_vts[i])
+					vt_ptrs.push_back(&vt);
+				auto costs = complete_plan.time(vt_ptrs);
+				list<ViewTuple> vts;
+				uint k=0;
+				for(auto& vt: query_vts[i]) {
+					vt.cost_lb = costs[k++];
+					if(vt.cost_lb<max_vt_lb)
+						vts.push_back(vt);
 				}
+				if(!vts.empty())
+					query_buffers[qid].push_back(make_pair(query_candidates[i], std::move(vts)));
+			}
+		}
+	};
+	uint num_workers = (num_threads==0 ? max(1u, std::thread::hardware_concurrency()) : num_threads);
+	vector<std::thread> workers;
+	for(uint t=1; t<num_workers && t<rep_ids.size(); t++)
+		workers.push_back(std::thread(fill_buffers));
+	fill_buffers();
+	for(auto& worker: workers)
+		worker.join();
+
+	for(uint qid=0; qid<query_ptrs.size(); qid++) {
+		auto query_ptr = query_ptrs[qid];
+		int rep = representative[qid];
+		for(auto& index_vts: query_buffers[rep<0 ? qid : rep]) {
+			auto index_ptr = index_vts.first;
+			for(auto& vt: index_vts.second) {
+				view_tuples_pool.push_back(rep<0 ? vt : ViewTuple(vt, *query_ptr, isos[qid]));
+				index_to_query2vt[index_ptr][query_ptr].insert(&(view_tuples_pool.back()));
+				query_to_index2vt[query_ptr][index_ptr].insert(&(view_tuples_pool.back()));
 			}
 		}
 	}
@@ -243,7 +278,7 @@ void Application::generate_candidates() {
 		// assert(false);
 		unordered_map<int, Plan> goalordernum2plan;
 		for(int i=0; i<=query.expression().num_goals(); i++) {
-			goalordernum2plan.emplace(i, Plan(query));
+			goalordernum2plan.emplace(i, Plan(query, sampler.get()));
 			for(int j=0; j<i; j++)
 				goalordernum2plan.at(i).append(*goalnum2vt[query.goal_order().at(j)]);
 			// cout<<"---------------------------\n";
@@ -266,6 +301,9 @@ void Application::generate_candidates() {
 			cout<<vt.show()<<endl;
 		}
 
+	uint num_pruned = prune_dominated_view_tuples();
+	cout<<"pruned "<<num_pruned<<" dominated view tuples, "<<view_tuples_pool.size()<<" left\n";
+
 	// delete indexes that have no feasible view tuples
 	vector<list<Index>::iterator> unwanted_indexes;
 	for(auto it=indexes.begin(); it!=indexes.end(); it++)
@@ -273,6 +311,54 @@ void Application::generate_candidates() {
 			unwanted_indexes.push_back(it);
 	for(auto it: unwanted_indexes)
 		indexes.erase(it);
+
+	store.build(queries, index_to_query2vt);
+}
+
+namespace {
+
+/**vt1 dominates vt2 if it is from the same index and query, has every subcore of vt2 (and so covers 
+every goal vt2 does) and neither of its cost bounds is higher. This is a heuristic: the optimizers 
+price a view tuple with Plan::time against the partial plan it is added to, where vt2 can still be 
+the cheaper one*/
+bool dominates(const ViewTuple& vt1, const ViewTuple& vt2) {
+	if(&vt1.index!=&vt2.index || &vt1.query!=&vt2.query)
+		return false;
+	if(vt1.cost_lb>vt2.cost_lb || vt1.cost_ub>vt2.cost_ub)
+		return false;
+	for(const auto& subcore: vt2.subcores)
+		if(vt1.subcores.find(subcore)==vt1.subcores.end())
+			return false;
+	return true;
+}
+
+}
+
+uint Application::prune_dominated_view_tuples() {
+	// view tuples of each (index, query) pair in pool order. Of view tuples dominating each other 
+	// the first one is kept
+	map<pair<const Index*, const Query*>, vector<const ViewTuple*>> groups;
+	for(const auto& vt: view_tuples_pool)
+		groups[make_pair(&vt.index, &vt.query)].push_back(&vt);
+	set<const ViewTuple*> dominated;
+	for(const auto& group: groups) {
+		const auto& vts = group.second;
+		for(uint i=0; i<vts.size(); i++)
+			for(uint j=0; j<vts.size(); j++)
+				if(i!=j && dominates(*vts[j], *vts[i]) && (j<i || !dominates(*vts[i], *vts[j]))) {
+					dominated.insert(vts[i]);
+					break;
+				}
+	}
+
+	for(auto vt: dominated) {
+		index_to_query2vt.at(&vt->index).at(&vt->query).erase(vt);
+		query_to_index2vt.at(&vt->query).at(&vt->index).erase(vt);
+	}
+	view_tuples_pool.remove_if([&](const ViewTuple& vt) {
+		return dominated.find(&vt)!=dominated.end();
+	});
+	return dominated.size();
 }
 
 void Application::show_candidates() const {
@@ -325,38 +411,112 @@ void Application::show_candidates() const {
 }
 
 
-set<const ViewTuple*> Application::inner_greedy(const Index* index, uint& negc,
-	double& cost, const map<const Query*, set<uint>>& rem_goals, uint num_rem_goals,
-	const unordered_map<const Query*, Plan>& q2plan, bool oe) const {
-	
+void Application::ViewTupleStore::build(const list<Query>& qs, 
+	const map<const Index*, map<const Query*, set<const ViewTuple*>>>& index_to_query2vt) {
+	*this = ViewTupleStore();
+	narrow = true;
+	for(auto& query: qs) {
+		query_ids[&query] = queries.size();
+		queries.push_back(&query);
+		query_weights.push_back(query.weight());
+		narrow = narrow && query.expression().num_goals()<=(int) esutils::max_mask_size;
+	}
+	for(const auto& index_query2vt: index_to_query2vt) {
+		index_offsets.push_back(vts.size());
+		for(const auto& query_vts: index_query2vt.second)
+			for(auto vt: query_vts.second) {
+				uint qid = query_ids.at(query_vts.first);
+				vts.push_back(vt);
+				query_id.push_back(qid);
+				cost_lb.push_back(vt->cost_lb * query_weights[qid]);
+				cost_ub.push_back(vt->cost_ub * query_weights[qid]);
+				sc_goals.push_back(vt->sc_goals);
+				wc_goals.push_back(vt->wc_goals);
+				sc_masks.push_back(vt->sc_goals.mask());
+				wc_masks.push_back(vt->wc_goals.mask());
+			}
+		indexes.push_back(index_query2vt.first);
+	}
+	index_offsets.push_back(vts.size());
+}
+
+void Application::ViewTupleStore::covered_counts(uint index, bool oe, 
+	const vector<BitSet>& rem_goals, vector<uint>& counts) const {
+	uint begin = index_offsets[index], end = index_offsets[index+1];
+	counts.resize(end-begin);
+	if(narrow) {
+		const auto& masks = (oe ? sc_masks : wc_masks);
+		for(uint id=begin; id<end; id++)
+			counts[id-begin] = __builtin_popcountll(masks[id] & rem_goals[query_id[id]].mask());
+	}
+	else {
+		const auto& goals = (oe ? sc_goals : wc_goals);
+		for(uint id=begin; id<end; id++)
+			counts[id-begin] = goals[id].intersection_size(rem_goals[query_id[id]]);
+	}
+}
+
+uint Application::best_ratio(const vector<double>& costs, const vector<uint>& counts) {
+	uint best=0;
+	for(uint k=1; k<counts.size(); k++)
+		if(counts[best]==0 || (counts[k]!=0 && costs[k]/counts[k] < costs[best]/counts[best]))
+			best = k;
+	return best;
+}
+
+void Application::row_costs(uint index, bool oe, const unordered_map<const Query*, Plan>* q2plan, 
+	vector<double>& costs) const {
+	uint begin = store.index_offsets[index], end = store.index_offsets[index+1];
+	costs.resize(end-begin);
+	if(!oe)
+		std::copy(store.cost_lb.begin()+begin, store.cost_lb.begin()+end, costs.begin());
+	else if(q2plan==nullptr)
+		std::copy(store.cost_ub.begin()+begin, store.cost_ub.begin()+end, costs.begin());
+	else
+		// the view tuples of a query are consecutive in the row and timed against its plan together
+		for(uint id=begin, next; id<end; id=next) {
+			uint qid = store.query_id[id];
+			for(next=id+1; next<end && store.query_id[next]==qid; next++);
+			auto query_costs = q2plan->at(store.queries[qid]).time(
+				vector<const ViewTuple*>(store.vts.begin()+id, store.vts.begin()+next));
+			for(uint k=id; k<next; k++)
+				costs[k-begin] = query_costs[k-id] * store.query_weights[qid];
+		}
+}
+
+set<const ViewTuple*> Application::inner_greedy(uint index, uint& negc, double& cost, 
+	const vector<BitSet>& rem_goals, uint num_rem_goals, 
+	const unordered_map<const Query*, Plan>* q2plan, bool oe) const {
 	auto best_set = set<const ViewTuple*>{};
 	double best_cost = 0;  uint best_negc = 0;
+	uint begin = store.index_offsets[index];
+	if(begin==store.index_offsets[index+1]) {
+		cost = best_cost; negc = best_negc;
+		return best_set;
+	}
+	// costs of the view tuples do not change while the index is considered
+	vector<double> costs;
+	row_costs(index, oe, q2plan, costs);
+	vector<uint> counts;
+	const auto& covered = (oe ? store.sc_goals : store.wc_goals);
 
 	for(uint target=1; target<=num_rem_goals; target++) {
 		auto cand_set = set<const ViewTuple*>{}; 
-		double cand_cost = index->storage_cost() * wt_storage; uint cand_negc=0; 
+		double cand_cost = store.indexes[index]->storage_cost() * wt_storage; uint cand_negc=0; 
 		auto cand_rem_goals = rem_goals; // goals yet to be covered by cand
 		while(cand_negc<target) {
-			const ViewTuple* best_vt=NULL;	double best_vt_cost=-1;  uint best_vt_negc=0;
-			for(auto query_setvt: index_to_query2vt.at(index)) 
-				for(auto vt: query_setvt.second) {
-					double vt_cost = (oe ? q2plan.at(&(vt->query)).time(vt) 
-							: vt->cost_lb) * vt->query.weight();
-					uint vt_negc = min((uint) (target-cand_negc), 
-						set_intersection_size(vt->covered_goals(oe), cand_rem_goals[&(vt->query)]));
-					bool replace = ((best_vt==NULL || best_vt_negc==0) ? true: 
-						vt_negc==0 ? false: vt_cost/vt_negc < best_vt_cost/best_vt_negc);
-					if(replace) {
-						best_vt = vt; best_vt_cost = vt_cost; best_vt_negc = vt_negc;
-					}
-				}
-			if(best_vt==NULL || best_vt_negc==0)
+			store.covered_counts(index, oe, cand_rem_goals, counts);
+			for(auto& count: counts)
+				count = min(target-cand_negc, count);
+			uint best_k = best_ratio(costs, counts);
+			if(counts[best_k]==0)
 				break;
-			cand_set.insert(best_vt);
-			cand_cost += best_vt_cost;   
-			best_vt_negc = set_intersection_size(best_vt->covered_goals(oe), cand_rem_goals[&(best_vt->query)]);
-			cand_negc += best_vt_negc;   
-			set_difference_inplace(cand_rem_goals[&(best_vt->query)], best_vt->covered_goals(oe));
+			uint id = begin+best_k;
+			auto& query_rem_goals = cand_rem_goals[store.query_id[id]];
+			cand_set.insert(store.vts[id]);
+			cand_cost += costs[best_k];   
+			cand_negc += set_intersection_size(covered[id], query_rem_goals);   
+			set_difference_inplace(query_rem_goals, covered[id]);
 		}
 		if(cand_negc<target)
 			break;
@@ -369,47 +529,31 @@ set<const ViewTuple*> Application::inner_greedy(const Index* index, uint& negc,
 	return best_set;
 }
 
-
-Application::Design Application::optimize_wsc(const Design& Dinit, bool oe) const {
-	set<const Index*> stored_indexes = Dinit.stored_indexes;
-	unordered_map<const Query*, Plan> q2plan = Dinit.plans;
-	//cout<<"Got input design: "<<Dinit.show()<<endl;
-	map<const Query*, set<uint>> rem_goals;
+set<const Index*> Application::greedy_cover(set<const Index*> stored_indexes, vector<BitSet> rem_goals, 
+	const unordered_map<const Query*, Plan>* q2plan, bool oe, 
+	function<void(const ViewTuple*)> add_vt) const {
 	uint num_rem_goals=0;
-	for(auto& query: queries) {
-		set<uint> query_goals;
-		for(uint i=0; (int) i<query.expression().num_goals(); i++)
-			query_goals.insert(i);
-		auto plan_goals = q2plan.at(&query).covered_goals(oe);
-		rem_goals[&query] = set_difference(query_goals, plan_goals);
-		num_rem_goals += rem_goals[&query].size();
-	}
+	for(const auto& goals: rem_goals)
+		num_rem_goals += goals.size();
 
+	vector<double> costs;
+	vector<uint> counts;
 	while(num_rem_goals>0) {
 		pair<const Index*, set<const ViewTuple*>> best_set;
 		double best_cost=0; uint best_negc=0;   // cost and number of extra goals covered by best_set
-		for(auto it=index_to_query2vt.begin(); it!=index_to_query2vt.end(); it++) {
-			auto index = it->first;
+		for(uint index=0; index<store.indexes.size(); index++) {
+			auto index_ptr = store.indexes[index];
 			pair<const Index*, set<const ViewTuple*>> cand_set;
 			double cand_cost=0; uint cand_negc = 0;
-			if(stored_indexes.find(index)==stored_indexes.end()) 
-				cand_set = make_pair(index, inner_greedy(index, cand_negc, cand_cost, 
+			if(stored_indexes.find(index_ptr)==stored_indexes.end()) 
+				cand_set = make_pair(index_ptr, inner_greedy(index, cand_negc, cand_cost, 
 					rem_goals, num_rem_goals, q2plan, oe));
 			else {
-				const ViewTuple* best_vt;  uint best_vt_negc=0;  double best_vt_cost=0;
-				for(auto query_setvt: it->second) 
-					for(auto vt: query_setvt.second) {
-						double vt_cost = (oe ? q2plan.at(&(vt->query)).time(vt) 
-							: vt->cost_lb) * vt->query.weight();
-						double vt_negc = set_intersection_size(vt->covered_goals(oe), rem_goals[&(vt->query)]);
-						bool replace=(best_vt_negc==0 ? true : vt_negc==0? false : 
-										vt_cost/vt_negc < best_vt_cost/best_vt_negc);
-						if(replace) {
-							best_vt = vt; best_vt_negc=vt_negc; best_vt_cost=vt_cost;
-						} 
-					}
-				cand_set = make_pair(index, set<const ViewTuple*>{best_vt});
-				cand_cost = best_vt_cost;  cand_negc = best_vt_negc;
+				row_costs(index, oe, q2plan, costs);
+				store.covered_counts(index, oe, rem_goals, counts);
+				uint best_k = best_ratio(costs, counts);
+				cand_set = make_pair(index_ptr, set<const ViewTuple*>{store.vts[store.index_offsets[index]+best_k]});
+				cand_cost = costs[best_k];  cand_negc = counts[best_k];
 			}
 			bool replace = ((best_set.first==NULL || best_negc==0) ? true: 
 				cand_negc==0 ? false : cand_cost/cand_negc < best_cost/best_negc);
@@ -423,10 +567,25 @@ Application::Design Application::optimize_wsc(const Design& Dinit, bool oe) cons
 		num_rem_goals -= best_negc;
 		stored_indexes.insert(best_set.first);
 		for(auto vt: best_set.second) {
-			set_difference_inplace(rem_goals[&(vt->query)], vt->covered_goals(oe));
-			q2plan.at(&(vt->query)).append(*vt);
+			set_difference_inplace(rem_goals[store.query_ids.at(&(vt->query))], vt->covered_goals(oe));
+			add_vt(vt);
 		}
 	}
+	return stored_indexes;
+}
+
+Application::Design Application::optimize_wsc(const Design& Dinit, bool oe) const {
+	unordered_map<const Query*, Plan> q2plan = Dinit.plans;
+	//cout<<"Got input design: "<<Dinit.show()<<endl;
+	vector<BitSet> rem_goals;
+	for(auto query: store.queries) {
+		BitSet query_goals;
+		for(uint i=0; (int) i<query->expression().num_goals(); i++)
+			query_goals.insert(i);
+		rem_goals.push_back(set_difference(query_goals, q2plan.at(query).covered_goals(oe)));
+	}
+	auto stored_indexes = greedy_cover(Dinit.stored_indexes, rem_goals, &q2plan, oe, 
+		[&](const ViewTuple* vt) {q2plan.at(&(vt->query)).append(*vt);});
 	return Design(stored_indexes, q2plan);
 }
 
@@ -492,7 +651,7 @@ string Application::Design::show() const {
 Application::Design Application::get_empty_design() const {
 	unordered_map<const Query*, Plan> empty_plans;
 	for(auto& query: queries)
-		empty_plans.emplace(&query, Plan(query));
+		empty_plans.emplace(&query, Plan(query, sampler.get()));
 	return Design(set<const Index*>(), empty_plans);
 }
 
@@ -529,14 +688,24 @@ list<Application::Design> Application::expand(const Application::Design& D) cons
 	priority_queue<pair<double, const Design*>> best_designs;
 	for(auto query_ind2vt: query_to_index2vt) {
 		auto query = query_ind2vt.first;
+		const auto& plan = D.plans.at(query);
+		if(plan.iscomplete()) continue;
+		// the query's candidate view tuples are timed against its plan in one batch
+		vector<const ViewTuple*> vts;
+		for(auto ind_vt: query_ind2vt.second)
+			for(auto vt: ind_vt.second)
+				if(!plan.has_vt(vt))
+					vts.push_back(vt);
+		auto times = plan.time(vts);
+		uint k=0;
 		for(auto ind_vt: query_ind2vt.second) {
 			for(auto vt: ind_vt.second) {
-				if(!D.plans.at(query).has_vt(vt) && !D.plans.at(query).iscomplete()) {
+				if(!plan.has_vt(vt)) {
 					double new_cost = D.cost;
 					if(D.stored_indexes.find(ind_vt.first)==D.stored_indexes.end())
 						new_cost += wt_storage * ind_vt.first->storage_cost();
-					new_cost += query->weight() * D.plans.at(query).time(vt);
-					int extra_cov_goals = D.plans.at(query).extra_wc_goals(*(vt));
+					new_cost += query->weight() * times[k++];
+					int extra_cov_goals = plan.extra_wc_goals(*(vt));
 					if(new_cost<Lub) {
 						neighbors.push_back(D);
 						neighbors.back().append(vt);
@@ -636,110 +805,41 @@ Application::Design Application::optimize() {
 
 ///////////////////////////////stanalone wsc functions
 
-set<const ViewTuple*> Application::inner_greedy_standalone(const Index* index, uint& negc,
-	double& cost, const map<const Query*, set<uint>>& rem_goals, uint num_rem_goals, bool oe) const {
-	
-	auto best_set = set<const ViewTuple*>{};
-	double best_cost = 0;  uint best_negc = 0;
-
-	for(uint target=1; target<=num_rem_goals; target++) {
-		auto cand_set = set<const ViewTuple*>{}; 
-		double cand_cost = index->storage_cost() * wt_storage; uint cand_negc=0; 
-		auto cand_rem_goals = rem_goals; // goals yet to be covered by cand
-		while(cand_negc<target) {
-			const ViewTuple* best_vt=NULL;	double best_vt_cost=-1;  uint best_vt_negc=0;
-			for(auto query_setvt: index_to_query2vt.at(index)) 
-				for(auto vt: query_setvt.second) {
-					double vt_cost = (oe ? vt->cost_ub : vt->cost_lb) * vt->query.weight();
-					uint vt_negc = min((uint) (target-cand_negc), 
-						set_intersection_size(vt->covered_goals(oe), cand_rem_goals[&(vt->query)]));
-					bool replace = ((best_vt==NULL || best_vt_negc==0) ? true: 
-						vt_negc==0 ? false: vt_cost/vt_negc < best_vt_cost/best_vt_negc);
-					if(replace) {
-						best_vt = vt; best_vt_cost = vt_cost; best_vt_negc = vt_negc;
-					}
-				}
-			if(best_vt==NULL || best_vt_negc==0)
-				break;
-			cand_set.insert(best_vt);
-			cand_cost += best_vt_cost;   
-			best_vt_negc = set_intersection_size(best_vt->covered_goals(oe), cand_rem_goals[&(best_vt->query)]);
-			cand_negc += best_vt_negc;   
-			set_difference_inplace(cand_rem_goals[&(best_vt->query)], best_vt->covered_goals(oe));
-		}
-		if(cand_negc<target)
-			break;
-		bool replace = (cand_negc==0 ? false : best_negc==0 ? true : cand_cost/cand_negc < best_cost/best_negc);
-		if(replace) {
-			best_set = cand_set; best_cost = cand_cost; best_negc = cand_negc;
-		}
-	}
-	cost = best_cost; negc = best_negc; 
-	return best_set;
-}
-
 Application::Design Application::optimize_wsc_standalone(bool oe) {
-	set<const Index*> stored_indexes;
-	map<const Query*, set<uint>> rem_goals;
+	vector<BitSet> rem_goals;
 	unordered_map<const Query*, vector<pair<uint, const ViewTuple*>>> q2vts;
-	uint num_rem_goals=0;
-	for(auto& query: queries) {
-		set<uint> query_goals;
-		for(uint i=0; (int) i<query.expression().num_goals(); i++)
+	for(auto query: store.queries) {
+		BitSet query_goals;
+		for(uint i=0; (int) i<query->expression().num_goals(); i++)
 			query_goals.insert(i);
-		rem_goals[&query] = query_goals;
-		num_rem_goals += rem_goals[&query].size();
-		q2vts[&query] = vector<pair<uint, const ViewTuple*>>();
+		rem_goals.push_back(query_goals);
+		q2vts[query] = vector<pair<uint, const ViewTuple*>>();
 	}
+	auto stored_indexes = greedy_cover(set<const Index*>(), rem_goals, nullptr, oe, 
+		[&](const ViewTuple* vt) {q2vts[&(vt->query)].push_back(make_pair(vt->first_sc_goal_ind, vt));});
 
-	while(num_rem_goals>0) {
-		pair<const Index*, set<const ViewTuple*>> best_set;
-		double best_cost=0; uint best_negc=0;   // cost and number of extra goals covered by best_set
-		for(auto it=index_to_query2vt.begin(); it!=index_to_query2vt.end(); it++) {
-			auto index = it->first;
-			pair<const Index*, set<const ViewTuple*>> cand_set;
-			double cand_cost=0; uint cand_negc = 0;
-			if(stored_indexes.find(index)==stored_indexes.end()) 
-				cand_set = make_pair(index, inner_greedy_standalone(index, cand_negc, cand_cost, 
-					rem_goals, num_rem_goals, oe));
-			else {
-				const ViewTuple* best_vt;  uint best_vt_negc=0;  double best_vt_cost=0;
-				for(auto query_setvt: it->second) 
-					for(auto vt: query_setvt.second) {
-						double vt_cost = (oe ? vt->cost_ub: vt->cost_lb) * vt->query.weight();
-						double vt_negc = set_intersection_size(vt->covered_goals(oe), rem_goals[&(vt->query)]);
-						bool replace=(best_vt_negc==0 ? true : vt_negc==0? false : 
-										vt_cost/vt_negc < best_vt_cost/best_vt_negc);
-						if(replace) {
-							best_vt = vt; best_vt_negc=vt_negc; best_vt_cost=vt_cost;
-						} 
-					}
-				cand_set = make_pair(index, set<const ViewTuple*>{best_vt});
-				cand_cost = best_vt_cost;  cand_negc = best_vt_negc;
-			}
-			bool replace = ((best_set.first==NULL || best_negc==0) ? true: 
-				cand_negc==0 ? false : cand_cost/cand_negc < best_cost/best_negc);
-			if(replace) {
-				best_set = cand_set; best_cost = cand_cost;  best_negc = cand_negc;
-			}
-		}
-		assert(best_negc>0);
-		assert(best_set.first!=NULL);
-		assert(best_set.second.size()!=0);
-		num_rem_goals -= best_negc;
-		stored_indexes.insert(best_set.first);
-		for(auto vt: best_set.second) {
-			set_difference_inplace(rem_goals[&(vt->query)], vt->covered_goals(oe));
-			q2vts[&(vt->query)].push_back(make_pair(vt->first_sc_goal_ind, vt));
-		}
-	}
 	unordered_map<const Query*, Plan> q2plan;
 	for(auto& query: queries) {
 		sort(q2vts[&query].begin(), q2vts[&query].end());
-		q2plan.emplace(&query, Plan(query));
+		q2plan.emplace(&query, Plan(query, sampler.get()));
 		for(auto& priority_vt: q2vts[&query])
 			q2plan.at(&query).append(*(priority_vt.second));
 	}
 
 	return Design(stored_indexes, q2plan);
-}
\ No newline at end of file
+}
+
+BitMatrix Application::index_containment_matrix(uint num_threads) const {
+	vector<const Expression*> exps;
+	for(auto& index: indexes)
+		exps.push_back(&(index.expression()));
+	return containment_matrix(exps, num_threads);
+}
+
+BitMatrix Application::query_containment_matrix(uint num_threads) const {
+	vector<const Expression*> exps;
+	for(auto& query: queries)
+		exps.push_back(&(query.expression()));
+	return containment_matrix(exps, num_threads);
+}
+
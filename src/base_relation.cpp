@@ -1,10 +1,13 @@
 #include "base_relation.h"
 #include "data.h"
+#include "statistics.h"
 
 #include <string>
 #include <vector>
 #include <set>
 #include <map>
+#include <cassert>
+#include <algorithm>
 
 using std::string;
 using std::vector;
@@ -65,4 +68,51 @@ double BaseRelation::card_at(int col) const {
 
 double BaseRelation::num_tuples() const {
 	return numtups;
-}
\ No newline at end of file
+}
+
+void BaseRelation::analyze(const vector<vector<Data>>& tuples, bool joint) {
+	StatisticsCollector collector(columns.size(), joint);
+	for(auto& tuple: tuples)
+		collector.add_tuple(tuple);
+	stats = collector.statistics();
+	num_distinct_tuples = collector.num_distinct_tuples();
+	pair_cards = collector.num_distinct_pairs();
+	// an empty relation is taken to hold a single tuple, as estimates divide by its size
+	numtups = std::max<size_t>(1, tuples.size());
+	for(uint col=0; col<columns.size(); col++)
+		columns[col].cardinality = std::max(1.0, stats[col].num_distinct);
+}
+
+bool BaseRelation::has_statistics() const {
+	return !stats.empty();
+}
+
+const ColumnStatistics& BaseRelation::statistics_at(int col) const {
+	assert(has_statistics());
+	return stats.at(col);
+}
+
+double BaseRelation::value_count(int col, const Data& dt) const {
+	if(!has_statistics())
+		return numtups/card_at(col);
+	return stats.at(col).value_count(dt);
+}
+
+bool BaseRelation::has_joint_card(const std::set<int>& cols) const {
+	if(cols.size()==1)
+		return true;
+	if(num_distinct_tuples==0)
+		return false;
+	if(cols.size()==columns.size())
+		return true;
+	return cols.size()==2 && pair_cards.find(std::make_pair(*cols.begin(), *cols.rbegin()))!=pair_cards.end();
+}
+
+double BaseRelation::joint_card(const std::set<int>& cols) const {
+	assert(has_joint_card(cols));
+	if(cols.size()==1)
+		return card_at(*cols.begin());
+	if(cols.size()==columns.size())
+		return std::max(1.0, num_distinct_tuples);
+	return std::max(1.0, pair_cards.at(std::make_pair(*cols.begin(), *cols.rbegin())));
+}
@@ -6,6 +6,16 @@
 #include <string>
 #include <set>
 #include <iostream>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <thread>
+#include <functional>
+#include <atomic>
 
 using std::map;
 using std::set;
@@ -47,6 +57,10 @@ int ContainmentMap::goal_at(int gid) const {
 	return goal_s2d.at(gid);
 }
 
+const map<int, Expression::Symbol>& ContainmentMap::var_map() const {
+	return var_s2d;
+}
+
 bool ContainmentMap::empty() const {
 	return src_exp==NULL;
 }
@@ -71,76 +85,522 @@ string ContainmentMap::show() const {
 
 
 
-bool containment_map_exists(const Expression* src_exp, const Expression* dest_exp, 
-	int pos, map<int, Expression::Symbol>& var2symb) {
-	if(pos==src_exp->num_goals()) {
-		set<int> covered_head_vars;
-		auto target_head_vars = dest_exp->head_vars();
-		for(auto head_var: src_exp->head_vars()) {
-			if(!var2symb.at(head_var).isconstant) 
-				if(target_head_vars.find(var2symb.at(head_var).var)!=target_head_vars.end())
-					covered_head_vars.insert(var2symb.at(head_var).var);
+namespace {
+
+/**Backtracking search for a containment map from the goals of src_exp to the goals of dest_exp. 
+Every source goal keeps a domain of destination goals it can still be mapped to. Domains start out 
+as the destination goals over the same relation that agree with the goal's constants, head variable 
+kinds and repeated variables. The goal with the smallest domain is mapped next and, whenever a 
+variable gets bound, the domains of the unmapped goals containing it are filtered (forward checking). 
+Filtered entries are swapped past the end of the domain and restored by resetting its size.*/
+class ContainmentMapSearch {
+	const Expression* src_exp;
+	const Expression* dest_exp;
+	std::vector<std::vector<int>> domains;
+	std::vector<uint> domain_sizes;
+	std::vector<bool> mapped;
+	std::vector<std::pair<int, uint>> trail;  //!< (goal, domain size before filtering)
+	map<int, Expression::Symbol>& var2symb;
+
+	bool statically_compatible(int gid, int dgid) const;
+	bool consistent(int gid, int dgid) const;
+	bool covers_head_vars() const;
+	bool forward_check(int var);
+	bool search(int num_mapped);
+public:
+	ContainmentMapSearch(const Expression* src, const Expression* dest, 
+		map<int, Expression::Symbol>& var2symb_arg);
+	bool run();
+};
+
+ContainmentMapSearch::ContainmentMapSearch(const Expression* src, const Expression* dest, 
+	map<int, Expression::Symbol>& var2symb_arg) : src_exp(src), dest_exp(dest), 
+	domains(src->num_goals()), domain_sizes(src->num_goals(), 0), 
+	mapped(src->num_goals(), false), var2symb(var2symb_arg) {
+	
+	map<const BaseRelation*, std::vector<int>> br2dest_goals;
+	for(int dgid=0; dgid<dest_exp->num_goals(); dgid++)
+		br2dest_goals[dest_exp->goal_at(dgid).br].push_back(dgid);
+	for(int gid=0; gid<src_exp->num_goals(); gid++) {
+		auto it = br2dest_goals.find(src_exp->goal_at(gid).br);
+		if(it==br2dest_goals.end()) continue;
+		for(int dgid: it->second)
+			if(statically_compatible(gid, dgid))
+				domains[gid].push_back(dgid);
+		domain_sizes[gid] = domains[gid].size();
+	}
+}
+
+/**checks the conditions that do not depend on the mapping of other goals*/
+bool ContainmentMapSearch::statically_compatible(int gid, int dgid) const {
+	const auto& symbols = src_exp->goal_at(gid).symbols;
+	const auto& dest_symbols = dest_exp->goal_at(dgid).symbols;
+	for(uint i=0; i<symbols.size(); i++) {
+		if(symbols[i].isconstant) {
+			if(symbols[i]!=dest_symbols[i]) return false;
+			continue;
+		}
+		int var = symbols[i].var;
+		if(src_exp->is_free_headvar(var) && (dest_symbols[i].isconstant 
+			|| !dest_exp->is_free_headvar(dest_symbols[i].var)))
+			return false;
+		if(src_exp->is_bound_headvar(var) && (dest_symbols[i].isconstant 
+			|| !dest_exp->is_bound_headvar(dest_symbols[i].var)))
+			return false;
+		for(uint j=0; j<i; j++)
+			if(symbols[j]==symbols[i] && dest_symbols[j]!=dest_symbols[i])
+				return false;
+	}
+	return true;
+}
+
+bool ContainmentMapSearch::consistent(int gid, int dgid) const {
+	const auto& symbols = src_exp->goal_at(gid).symbols;
+	const auto& dest_symbols = dest_exp->goal_at(dgid).symbols;
+	for(uint i=0; i<symbols.size(); i++) 
+		if(!symbols[i].isconstant) {
+			auto it = var2symb.find(symbols[i].var);
+			if(it!=var2symb.end() && it->second!=dest_symbols[i])
+				return false;
+		}
+	return true;
+}
+
+bool ContainmentMapSearch::covers_head_vars() const {
+	set<int> covered_head_vars;
+	const auto& target_head_vars = dest_exp->head_vars();
+	for(auto head_var: src_exp->head_vars()) {
+		const auto& symb = var2symb.at(head_var);
+		if(!symb.isconstant && target_head_vars.find(symb.var)!=target_head_vars.end())
+			covered_head_vars.insert(symb.var);
+	}
+	return covered_head_vars.size()==target_head_vars.size();
+}
+
+/**filters the domains of unmapped goals containing a newly bound variable. Returns false if a domain 
+becomes empty*/
+bool ContainmentMapSearch::forward_check(int var) {
+	for(int gid: src_exp->goals_containing(var)) {
+		if(mapped[gid]) continue;
+		auto& domain = domains[gid];
+		uint size = domain_sizes[gid];
+		for(uint j=0; j<size; ) {
+			if(consistent(gid, domain[j])) j++;
+			else std::swap(domain[j], domain[--size]);
+		}
+		if(size!=domain_sizes[gid]) {
+			trail.push_back(std::make_pair(gid, domain_sizes[gid]));
+			domain_sizes[gid] = size;
+		}
+		if(size==0) return false;
+	}
+	return true;
+}
+
+bool ContainmentMapSearch::search(int num_mapped) {
+	if(num_mapped==src_exp->num_goals())
+		return covers_head_vars();
+
+	// pick the most constrained goal: smallest domain, then most bound symbols
+	int gid=-1, best_bound=-1;
+	for(int g=0; g<src_exp->num_goals(); g++) {
+		if(mapped[g]) continue;
+		if(gid>=0 && domain_sizes[g]>domain_sizes[gid]) continue;
+		int num_bound=0;
+		for(const auto& symbol: src_exp->goal_at(g).symbols)
+			if(symbol.isconstant || var2symb.find(symbol.var)!=var2symb.end())
+				num_bound++;
+		if(gid<0 || domain_sizes[g]<domain_sizes[gid] || num_bound>best_bound) {
+			gid = g;  best_bound = num_bound;
 		}
-		return covered_head_vars.size()==target_head_vars.size();
-	}
-
-	auto src_goal = src_exp->goal_at(pos);
-	for(int dpos=0; dpos<dest_exp->num_goals(); dpos++) {
-		auto dest_goal = dest_exp->goal_at(dpos);
-		if(src_goal.br==dest_goal.br) {
-			set<int> newly_mapped_vars;
-			bool match=true;
-			for(uint i=0; i<src_goal.symbols.size(); i++) {
-				if(src_goal.symbols.at(i).isconstant) {
-					if(src_goal.symbols.at(i) != dest_goal.symbols.at(i)) {
-						match=false; 
-						break;
-					}
-				}
-				else {
-					if(var2symb.find(src_goal.symbols.at(i).var)!=var2symb.end()) {
-						if(var2symb.at(src_goal.symbols.at(i).var)!=dest_goal.symbols.at(i)) {
-							match=false;
-							break;
-						}
-					}
-					else {
-						if((src_exp->is_free_headvar(src_goal.symbols.at(i).var) && 
-							!dest_exp->is_free_headvar(dest_goal.symbols.at(i).var)) ||
-							(src_exp->is_bound_headvar(src_goal.symbols.at(i).var) && 
-							!dest_exp->is_bound_headvar(dest_goal.symbols.at(i).var))) {
-							match=false;
-							break;
-						}
-						var2symb.emplace(src_goal.symbols.at(i).var, dest_goal.symbols.at(i));
-						newly_mapped_vars.insert(src_goal.symbols.at(i).var);
-					}
-				}
+	}
+	if(domain_sizes[gid]==0) return false;
+
+	mapped[gid] = true;
+	const auto& symbols = src_exp->goal_at(gid).symbols;
+	for(uint j=0; j<domain_sizes[gid]; j++) {
+		const auto& dest_symbols = dest_exp->goal_at(domains[gid][j]).symbols;
+		uint trail_size = trail.size();
+		std::vector<int> newly_mapped_vars;
+		for(uint i=0; i<symbols.size(); i++)
+			if(!symbols[i].isconstant && var2symb.find(symbols[i].var)==var2symb.end()) {
+				var2symb.emplace(symbols[i].var, dest_symbols[i]);
+				newly_mapped_vars.push_back(symbols[i].var);
 			}
-			if(match) {
-				pos+=1;
-				if(containment_map_exists(src_exp, dest_exp, pos, var2symb))
-					return true;
-				pos-=1;
+		bool feasible=true;
+		for(auto var: newly_mapped_vars)
+			if(!forward_check(var)) {
+				feasible = false;
+				break;
 			}
-			for(auto var: newly_mapped_vars) var2symb.erase(var);
+		if(feasible && search(num_mapped+1))
+			return true;
+		while(trail.size()>trail_size) {
+			domain_sizes[trail.back().first] = trail.back().second;
+			trail.pop_back();
 		}
+		for(auto var: newly_mapped_vars) var2symb.erase(var);
 	}
+	mapped[gid] = false;
 	return false;
 }
 
-ContainmentMap find_containment_map(const Expression* src_exp, const Expression* dest_exp) {
+bool ContainmentMapSearch::run() {
+	return search(0);
+}
+
+}
+
+FilterCounters::FilterCounters() : relations(0), constants(0), head_vars(0), 
+goal_patterns(0), searches(0) {}
+
+void FilterCounters::reset() {
+	relations = 0;  constants = 0;  head_vars = 0;  goal_patterns = 0;  searches = 0;
+}
+
+string FilterCounters::show() const {
+	return "rejected by relations: " + std::to_string(relations) 
+		+ ", constants: " + std::to_string(constants) 
+		+ ", head vars: " + std::to_string(head_vars)
+		+ ", goal patterns: " + std::to_string(goal_patterns)
+		+ "; searches: " + std::to_string(searches);
+}
+
+FilterCounters& filter_counters() {
+	static FilterCounters counters;
+	return counters;
+}
+
+namespace {
+
+/**checks if a goal with column pattern src can be mapped to a goal with column pattern dest: 
+constants have to stay constants and columns holding the same variable have to stay equal*/
+bool pattern_maps(const std::vector<int>& src, const std::vector<int>& dest) {
+	for(uint i=0; i<src.size(); i++) {
+		if(src[i]==-1) {
+			if(dest[i]!=-1) return false;
+		}
+		else if(src[i]!=(int) i) {
+			int j = src[i];
+			if(dest[i]!=dest[j] && !(dest[i]==-1 || dest[j]==-1))
+				return false;
+		}
+	}
+	return true;
+}
+
+bool patterns_map(const Expression::Invariants& src, const Expression::Invariants& dest) {
+	for(const auto& src_pattern: src.goal_patterns) {
+		bool found=false;
+		for(const auto& dest_pattern: dest.goal_patterns)
+			if(src_pattern.first==dest_pattern.first 
+				&& pattern_maps(src_pattern.second, dest_pattern.second)) {
+				found = true;
+				break;
+			}
+		if(!found) return false;
+	}
+	return true;
+}
+
+}
+
+bool goal_patterns_map(const Expression* src_exp, const Expression* dest_exp) {
+	return patterns_map(src_exp->invariants(), dest_exp->invariants());
+}
+
+/**Relations and constants of src_exp are preserved by a containment map and every head variable of 
+dest_exp is the image of a head variable of src_exp of the same kind*/
+bool may_contain(const Expression* src_exp, const Expression* dest_exp) {
+	const auto& src = src_exp->invariants();
+	const auto& dest = dest_exp->invariants();
+	if((src.relation_signature & ~dest.relation_signature)!=0
+		|| !std::includes(dest.relations.begin(), dest.relations.end(), 
+			src.relations.begin(), src.relations.end())) {
+		filter_counters().relations++;
+		return false;
+	}
+	if((src.constant_signature & ~dest.constant_signature)!=0
+		|| !std::includes(dest.constants.begin(), dest.constants.end(), 
+			src.constants.begin(), src.constants.end())) {
+		filter_counters().constants++;
+		return false;
+	}
+	if(src_exp->bound_headvars().size() < dest_exp->bound_headvars().size()
+		|| src_exp->head_vars().size()-src_exp->bound_headvars().size() 
+			< dest_exp->head_vars().size()-dest_exp->bound_headvars().size()) {
+		filter_counters().head_vars++;
+		return false;
+	}
+	if(!patterns_map(src, dest)) {
+		filter_counters().goal_patterns++;
+		return false;
+	}
+	return true;
+}
+
+/**isomorphic() tests containment in both directions, which makes the relation and constant sets and 
+the number of bound and free head variables equal. The multiset of goals is not an invariant since an 
+expression may contain redundant goals*/
+bool may_be_isomorphic(const Expression* exp1, const Expression* exp2) {
+	const auto& inv1 = exp1->invariants();
+	const auto& inv2 = exp2->invariants();
+	if(inv1.relation_signature!=inv2.relation_signature || inv1.relations!=inv2.relations) {
+		filter_counters().relations++;
+		return false;
+	}
+	if(inv1.constant_signature!=inv2.constant_signature || inv1.constants!=inv2.constants) {
+		filter_counters().constants++;
+		return false;
+	}
+	if(exp1->head_vars().size()!=exp2->head_vars().size()
+		|| exp1->bound_headvars().size()!=exp2->bound_headvars().size()) {
+		filter_counters().head_vars++;
+		return false;
+	}
+	if(!patterns_map(inv1, inv2) || !patterns_map(inv2, inv1)) {
+		filter_counters().goal_patterns++;
+		return false;
+	}
+	return true;
+}
+
+ContainmentCache::ContainmentCache(size_t capacity_arg, bool store_mappings_arg, uint key_bits_arg) : 
+capacity(capacity_arg), store_mappings(store_mappings_arg), 
+key_mask(key_bits_arg>=64 ? ~uint64_t(0) : (uint64_t(1)<<key_bits_arg)-1), num_hits(0), num_misses(0) {}
+
+uint64_t ContainmentCache::get_key(const Expression* exp1, const Expression* exp2, Kind kind) const {
+	uint64_t key = exp1->fingerprint()*0x9E3779B97F4A7C15ULL ^ exp2->fingerprint();
+	return (kind==Kind::Containment ? key : ~key) & key_mask;
+}
+
+bool ContainmentCache::lookup(const Expression* exp1, const Expression* exp2, Kind kind, 
+	bool& result, map<int, Expression::Symbol>& var2symb) {
+	std::lock_guard<std::shared_timed_mutex> lock(mtx);
+	auto it = key2entry.find(get_key(exp1, exp2, kind));
+	if(it==key2entry.end() || it->second->kind!=kind 
+		|| it->second->structure1!=exp1->get_structure() 
+		|| it->second->structure2!=exp2->get_structure()) {
+		num_misses++;
+		return false;
+	}
+	entries.splice(entries.begin(), entries, it->second);
+	result = it->second->result;
+	var2symb = it->second->var2symb;
+	num_hits++;
+	return true;
+}
+
+bool ContainmentCache::peek(const Expression* exp1, const Expression* exp2, Kind kind, 
+	bool& result, map<int, Expression::Symbol>& var2symb) const {
+	std::shared_lock<std::shared_timed_mutex> lock(mtx);
+	auto it = key2entry.find(get_key(exp1, exp2, kind));
+	if(it==key2entry.end() || it->second->kind!=kind 
+		|| it->second->structure1!=exp1->get_structure() 
+		|| it->second->structure2!=exp2->get_structure())
+		return false;
+	result = it->second->result;
+	var2symb = it->second->var2symb;
+	return true;
+}
+
+void ContainmentCache::insert(const Expression* exp1, const Expression* exp2, Kind kind, 
+	bool result, const map<int, Expression::Symbol>& var2symb) {
+	if(kind==Kind::Containment && result && !store_mappings)
+		return;
+	std::lock_guard<std::shared_timed_mutex> lock(mtx);
+	if(capacity==0) return;
+	uint64_t key = get_key(exp1, exp2, kind);
+	auto it = key2entry.find(key);
+	if(it!=key2entry.end()) {
+		entries.erase(it->second);
+		key2entry.erase(it);
+	}
+	Entry entry {key, kind, exp1->get_structure(), exp2->get_structure(), result, 
+		(kind==Kind::Containment ? var2symb : map<int, Expression::Symbol>())};
+	entries.push_front(entry);
+	key2entry[key] = entries.begin();
+	while(entries.size()>capacity) {
+		key2entry.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
+
+void ContainmentCache::set_capacity(size_t capacity_arg) {
+	std::lock_guard<std::shared_timed_mutex> lock(mtx);
+	capacity = capacity_arg;
+	while(entries.size()>capacity) {
+		key2entry.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
+
+void ContainmentCache::set_store_mappings(bool store) {
+	std::lock_guard<std::shared_timed_mutex> lock(mtx);
+	store_mappings = store;
+}
+
+void ContainmentCache::clear() {
+	std::lock_guard<std::shared_timed_mutex> lock(mtx);
+	entries.clear();
+	key2entry.clear();
+	num_hits = 0;
+	num_misses = 0;
+}
+
+size_t ContainmentCache::size() const {
+	std::shared_lock<std::shared_timed_mutex> lock(mtx);
+	return entries.size();
+}
+
+unsigned long ContainmentCache::hits() const {return num_hits;}
+unsigned long ContainmentCache::misses() const {return num_misses;}
+
+double ContainmentCache::hit_rate() const {
+	unsigned long total = num_hits+num_misses;
+	return (total==0 ? 0 : double(num_hits)/total);
+}
+
+string ContainmentCache::show() const {
+	return "cache entries: " + std::to_string(size()) + ", hits: " + std::to_string(hits())
+		+ ", misses: " + std::to_string(misses()) + ", hit rate: " + std::to_string(hit_rate());
+}
+
+ContainmentCache& containment_cache() {
+	static ContainmentCache cache;
+	return cache;
+}
+
+namespace {
+
+bool search_containment_map(const Expression* src_exp, const Expression* dest_exp,
+	map<int, Expression::Symbol>& var2symb) {
+	filter_counters().searches++;
+	return ContainmentMapSearch(src_exp, dest_exp, var2symb).run();
+}
+
+}
+
+namespace {
+
+/**runs the invariant filters, the cache and the search in that order*/
+bool cached_containment_map(const Expression* src_exp, const Expression* dest_exp,
+	map<int, Expression::Symbol>& var2symb) {
 	assert(src_exp!=NULL && dest_exp!=NULL);
+	if(!may_contain(src_exp, dest_exp))
+		return false;
+	auto& cache = containment_cache();
+	bool match;
+	if(!cache.lookup(src_exp, dest_exp, ContainmentCache::Kind::Containment, match, var2symb)) {
+		match = search_containment_map(src_exp, dest_exp, var2symb);
+		cache.insert(src_exp, dest_exp, ContainmentCache::Kind::Containment, match, var2symb);
+	}
+	return match;
+}
+
+}
+
+ContainmentMap find_containment_map(const Expression* src_exp, const Expression* dest_exp) {
 	map<int, Expression::Symbol> var2symb;
-	int pos=0;
-	bool match = containment_map_exists(src_exp, dest_exp, pos, var2symb);
-	if(match) 
+	if(cached_containment_map(src_exp, dest_exp, var2symb)) 
 		return ContainmentMap(src_exp, dest_exp, var2symb);
 	else
 		return ContainmentMap(NULL, NULL, map<int, Expression::Symbol>());
 }
 
+bool containment_map_exists(const Expression* src_exp, const Expression* dest_exp) {
+	map<int, Expression::Symbol> var2symb;
+	return cached_containment_map(src_exp, dest_exp, var2symb);
+}
+
 bool isomorphic(const Expression* exp1, const Expression* exp2) {
-	return ((!find_containment_map(exp1, exp2).empty()) &&
-		(!find_containment_map(exp2, exp1).empty()));
-}
\ No newline at end of file
+	if(!may_be_isomorphic(exp1, exp2))
+		return false;
+	auto& cache = containment_cache();
+	bool result;
+	map<int, Expression::Symbol> var2symb;
+	if(cache.lookup(exp1, exp2, ContainmentCache::Kind::Isomorphism, result, var2symb))
+		return result;
+	map<int, Expression::Symbol> var2symb_inv;
+	result = search_containment_map(exp1, exp2, var2symb) 
+		&& search_containment_map(exp2, exp1, var2symb_inv);
+	cache.insert(exp1, exp2, ContainmentCache::Kind::Isomorphism, result, var2symb);
+	cache.insert(exp2, exp1, ContainmentCache::Kind::Isomorphism, result, var2symb_inv);
+	return result;
+}
+
+
+// functions of class BitMatrix
+
+BitMatrix::BitMatrix(uint n_arg) : n(n_arg), words_per_row((n_arg+63)/64), 
+words(size_t(n_arg)*((n_arg+63)/64), 0) {}
+
+bool BitMatrix::at(uint row, uint col) const {
+	assert(row<n && col<n);
+	return (words[size_t(row)*words_per_row + col/64]>>(col%64)) & 1;
+}
+
+void BitMatrix::set(uint row, uint col) {
+	assert(row<n && col<n);
+	words[size_t(row)*words_per_row + col/64] |= uint64_t(1)<<(col%64);
+}
+
+uint BitMatrix::size() const {
+	return n;
+}
+
+uint BitMatrix::count() const {
+	uint result=0;
+	for(auto word: words)
+		result += __builtin_popcountll(word);
+	return result;
+}
+
+string BitMatrix::show() const {
+	string result;
+	for(uint row=0; row<n; row++) {
+		for(uint col=0; col<n; col++)
+			result += (at(row, col) ? '1' : '0');
+		result += "\n";
+	}
+	return result;
+}
+
+namespace {
+
+/**only peeks at the containment cache: the pairs of a matrix are rarely asked for again and would 
+evict the entries the optimizers reuse, and peeks do not serialize the workers*/
+void fill_containment_rows(const std::vector<const Expression*>& exps, 
+	std::atomic<uint>& next_row, BitMatrix& matrix) {
+	for(uint row=next_row++; row<exps.size(); row=next_row++)
+		for(uint col=0; col<exps.size(); col++) {
+			if(row==col) {
+				matrix.set(row, col);
+				continue;
+			}
+			map<int, Expression::Symbol> var2symb;
+			bool match = false;
+			if(may_contain(exps[row], exps[col]) 
+				&& !containment_cache().peek(exps[row], exps[col], ContainmentCache::Kind::Containment, match, var2symb))
+				match = search_containment_map(exps[row], exps[col], var2symb);
+			if(match)
+				matrix.set(row, col);
+		}
+}
+
+}
+
+BitMatrix containment_matrix(const std::vector<const Expression*>& exps, uint num_threads) {
+	BitMatrix matrix(exps.size());
+	if(num_threads==0) 
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::atomic<uint> next_row(0);
+	std::vector<std::thread> workers;
+	for(uint t=1; t<num_threads && t<exps.size(); t++)
+		workers.push_back(std::thread(fill_containment_rows, std::cref(exps), 
+			std::ref(next_row), std::ref(matrix)));
+	fill_containment_rows(exps, next_row, matrix);
+	for(auto& worker: workers)
+		worker.join();
+	return matrix;
+}
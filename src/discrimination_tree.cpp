@@ -0,0 +1,23 @@
+#include "discrimination_tree.h"
+#include "expression.h"
+#include "base_relation.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+using std::to_string;
+
+/**Relation keys compare by relation id and constant keys by their string representation. 
+Both lists in the invariants are already free of duplicates*/
+vector<string> discrimination_keys(const Expression& exp) {
+	vector<string> keys;
+	for(auto br: exp.invariants().relations)
+		keys.push_back("r"+to_string(br->get_id()));
+	for(const auto& dt: exp.invariants().constants)
+		keys.push_back("c"+dt.show());
+	std::sort(keys.begin(), keys.end());
+	return keys;
+}
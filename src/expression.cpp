@@ -14,14 +14,19 @@
 #include <cassert>
 #include <utility>
 #include <limits>
+#include <thread>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <chrono>
+#include <cmath>
 
 using std::string;
 using std::vector;
 using std::to_string;
-using std::stoi;
 using std::map;
 using std::set;
-using esutils::split;
 using std::queue;
 using esutils::left_padded_str;
 using esutils::oto_map;
@@ -29,7 +34,8 @@ using std::cout;
 using std::endl;
 using std::make_pair;
 using std::pair;
-using esutils::ExtremeFraction;
+using esutils::LogFraction;
+using esutils::BitSet;
 using esutils::OneMinusXN;
 using std::min;
 using std::max;
@@ -81,6 +87,101 @@ bool Expression::Goal::operator==(const Expression::Goal& goal) const {
 
 // functions of class Expression
 
+// functions of class Expression::ParseError
+
+Expression::ParseError::ParseError() : line(0), pos(-1), message("") {}
+
+string Expression::ParseError::show() const {
+	if(pos<0) return "(no error)";
+	return "line "+to_string(line)+", position "+to_string(pos)+": "+message;
+}
+
+// tokenizer used by the expression parser
+
+namespace {
+
+bool is_space(char chr) {
+	return chr==' ' || chr=='\n' || chr=='\t' || chr=='\r';
+}
+
+bool is_delimiter(char chr) {
+	return is_space(chr) || chr=='[' || chr==']' || chr=='(' || chr==')' 
+		|| chr==',' || chr==';' || chr==':';
+}
+
+/**Single pass tokenizer over the characters in [begin, end). Words are returned as pointers into 
+the input so that no intermediate strings are created while scanning*/
+class Lexer {
+	const char* begin;
+	const char* cur;
+	const char* end;
+public:
+	Lexer(const char* b, const char* e) : begin(b), cur(b), end(e) {}
+	void skip_spaces() {
+		while(cur!=end && is_space(*cur)) cur++;
+	}
+	int pos() {
+		skip_spaces();
+		return (int) (cur-begin);
+	}
+	void seek(int p) {
+		cur = begin+p;
+	}
+	bool at_end() {
+		skip_spaces();
+		return cur==end;
+	}
+	bool accept(char chr) {
+		skip_spaces();
+		if(cur==end || *cur!=chr) return false;
+		cur++;
+		return true;
+	}
+	bool accept_turnstile() {  //!< accepts ":-"
+		skip_spaces();
+		if(end-cur<2 || cur[0]!=':' || cur[1]!='-') return false;
+		cur+=2;
+		return true;
+	}
+	bool word(const char*& wbegin, const char*& wend) {  //!< returns false if the word is empty
+		skip_spaces();
+		wbegin = cur;
+		while(cur!=end && !is_delimiter(*cur)) cur++;
+		wend = cur;
+		return wend!=wbegin;
+	}
+};
+
+bool has_prefix(const char* wbegin, const char* wend, const char* prefix) {
+	for(; *prefix!='\0'; prefix++, wbegin++)
+		if(wbegin==wend || *wbegin!=*prefix) return false;
+	return true;
+}
+
+bool parse_int(const char* wbegin, const char* wend, int& val) {
+	bool negative = (wbegin!=wend && *wbegin=='-');
+	if(negative) wbegin++;
+	if(wbegin==wend) return false;
+	long long result=0;
+	for(; wbegin!=wend; wbegin++) {
+		if(*wbegin<'0' || *wbegin>'9') return false;
+		result = result*10 + (*wbegin-'0');
+		if(result>std::numeric_limits<int>::max()+1LL) return false;
+	}
+	if(negative) result = -result;
+	if(result>std::numeric_limits<int>::max()) return false;
+	val = (int) result;
+	return true;
+}
+
+bool parse_error(Expression::ParseError& error, int pos, const string& message) {
+	error.pos = pos;
+	error.message = message;
+	return false;
+}
+
+}
+
 /**Example expression: 
 Qent[k1, k2](d, e) :- K(k1, d); K(k2, d); E(e, d); C(e, str_phone); D(d, int_1)
 constants can either be strings or ints. Strings are enclosed in double quotes.
@@ -88,74 +189,215 @@ Strings cannot contain the characters ':', '-', ' ', '\n', '\t', '(', ')', '[',
 String constants start with the prefix 'str_' and ints start with the prefix 'int_'.
 Variables names cannot start with either of the two prefixes.
 */
-Expression::Expression(std::string expr, const map<std::string, const BaseRelation*>& name2br) :
+Expression::Expression(const std::string& expr, const map<std::string, const BaseRelation*>& name2br) :
 Expression() {
-	expr.erase(std::remove_if(expr.begin(), expr.end(), 
-		[](char chr){ return chr == ' ' || chr == '\n' || chr == '\t';}),
-	  expr.end());  // remove spaces, tabs and endlines
+	ParseError error;
+	bool success = parse_into(expr.data(), expr.data()+expr.size(), name2br, error);
+	if(!success)
+		cout<<"Malformed expression \""<<expr<<"\" at "<<error.show()<<endl;
+	assert(success);
+}
 
-	vector<string> head_body = split(expr, ":-");
-	assert(head_body.size()==2);
-	int numvars = 0;
+/**The head is only checked for syntax in the first pass because variables are numbered in 
+the order of their first appearance in the body. Head variables are resolved by re-scanning 
+the head once the body has been parsed.*/
+bool Expression::parse_into(const char* begin, const char* end, 
+	const map<std::string, const BaseRelation*>& name2br, ParseError& error) {
+	Lexer lex(begin, end);
+	const char *wbegin, *wend;
+
+	// Skip over the head
+	lex.word(wbegin, wend);
+	name.assign(wbegin, wend);
+	int head_pos = lex.pos();
+	if(!lex.accept('[')) return parse_error(error, lex.pos(), "expected '['");
+	for(char close: {']', ')'}) {
+		if(!lex.accept(close)) {
+			do {
+				if(!lex.word(wbegin, wend)) return parse_error(error, lex.pos(), "expected a head variable");
+			} while(lex.accept(','));
+			if(!lex.accept(close)) return parse_error(error, lex.pos(), string("expected '")+close+"'");
+		}
+		if(close==']' && !lex.accept('(')) return parse_error(error, lex.pos(), "expected '('");
+	}
+	if(!lex.accept_turnstile()) return parse_error(error, lex.pos(), "expected ':-'");
 
-	// Parse the body first
-	for(auto goal: split(head_body[1], ";")) {
-		vector<string> br_symbols = split(goal, "(");
-		assert(name2br.find(br_symbols[0])!=name2br.end());
-		auto br = name2br.at(br_symbols[0]);
-
-		vector<Symbol> symbols; 
-		vector<string> tokens = split(split(br_symbols[1],")")[0], ",");
-		assert(br->get_num_cols()== (int) tokens.size());
-		for(uint pos=0; pos<tokens.size(); pos++) {
-			if(tokens[pos].find("str_")==0) {
-				symbols.push_back(Symbol(Data(tokens[pos].substr(4, tokens[pos].size()-4))));
-				assert(br->dtype_at(pos)==Dtype::String);
+	// Parse the body
+	int numvars = 0;
+	do {
+		if(lex.at_end() && !goals.empty()) break;  // trailing ';'
+		int goal_pos = lex.pos();
+		if(!lex.word(wbegin, wend)) return parse_error(error, goal_pos, "expected a relation name");
+		auto br_it = name2br.find(string(wbegin, wend));
+		if(br_it==name2br.end()) return parse_error(error, goal_pos, "unknown relation '"+string(wbegin, wend)+"'");
+		auto br = br_it->second;
+		if(!lex.accept('(')) return parse_error(error, lex.pos(), "expected '('");
+
+		vector<Symbol> symbols;
+		symbols.reserve(br->get_num_cols());
+		do {
+			int pos = symbols.size();
+			int symbol_pos = lex.pos();
+			if(pos>=br->get_num_cols()) 
+				return parse_error(error, symbol_pos, "too many columns for relation '"+br->get_name()+"'");
+			if(!lex.word(wbegin, wend)) return parse_error(error, symbol_pos, "expected a symbol");
+			if(has_prefix(wbegin, wend, "str_")) {
+				if(br->dtype_at(pos)!=Dtype::String) return parse_error(error, symbol_pos, "string constant in an int column");
+				symbols.push_back(Symbol(Data(string(wbegin+4, wend))));
+			}
+			else if(has_prefix(wbegin, wend, "int_")) {
+				if(br->dtype_at(pos)!=Dtype::Int) return parse_error(error, symbol_pos, "int constant in a string column");
+				int val;
+				if(!parse_int(wbegin+4, wend, val)) return parse_error(error, symbol_pos+4, "malformed int constant");
+				symbols.push_back(Symbol(Data(val)));
 			}
 			else {
-				if(tokens[pos].find("int_")==0) {
-					symbols.push_back(Symbol(Data(stoi(tokens[pos].substr(4, tokens[pos].size()-4)))));
-					assert(br->dtype_at(pos)==Dtype::Int);
-				}
-				else {
-					string varname = tokens[pos];
-					if(name2var.find(varname)==name2var.end()) {
-						var2name[numvars] = varname;
-						var2dtype[numvars] = br->dtype_at(pos);
-						name2var[varname] = numvars++;
-					}
-					symbols.push_back(Symbol(name2var.at(varname)));
-					assert(var2dtype.at(name2var.at(varname))==br->dtype_at(pos));
+				string varname(wbegin, wend);
+				auto it = name2var.find(varname);
+				if(it==name2var.end()) {
+					var2name[numvars] = varname;
+					var2dtype[numvars] = br->dtype_at(pos);
+					it = name2var.emplace(varname, numvars++).first;
 				}
+				if(var2dtype.at(it->second)!=br->dtype_at(pos))
+					return parse_error(error, symbol_pos, "variable '"+varname+"' used with different types");
+				symbols.push_back(Symbol(it->second));
 			}
-		}
+		} while(lex.accept(','));
+		if(!lex.accept(')')) return parse_error(error, lex.pos(), "expected ')'");
+		if((int) symbols.size()!=br->get_num_cols()) 
+			return parse_error(error, goal_pos, "too few columns for relation '"+br->get_name()+"'");
 		goals.push_back(Goal(br, symbols));
-	}
-
-	// Parse the head
-	string head = head_body[0];
-	vector<string> name_head = split(head, "[");
-	assert(name_head.size()==2);
-	name = name_head[0];
-	for(auto varname: split(split(name_head[1], "]")[0], ",")) {  // bound head vars
-		assert(name2var.find(varname)!=name2var.end());
-		boundheadvars.insert(name2var.at(varname));
-		headvars.insert(name2var.at(varname));
-	}
-	auto freevars = split(split(split(split(name_head[1], "]")[1], "(")[1], ")")[0], ",");
-	for(auto varname: freevars) {
-		// free head vars
-		assert(name2var.find(varname)!=name2var.end());
-		freeheadvars.insert(name2var.at(varname));
-		headvars.insert(name2var.at(varname));
+	} while(lex.accept(';'));
+	if(!lex.at_end()) return parse_error(error, lex.pos(), "expected ';'");
+
+	// Resolve the head variables
+	lex.seek(head_pos);
+	lex.accept('[');
+	for(int i=0; i<2; i++) {
+		char close = (i==0 ? ']' : ')');
+		while(!lex.accept(close)) {
+			lex.accept(',');
+			int var_pos = lex.pos();
+			lex.word(wbegin, wend);
+			auto it = name2var.find(string(wbegin, wend));
+			if(it==name2var.end()) 
+				return parse_error(error, var_pos, "head variable '"+string(wbegin, wend)+"' does not appear in the body");
+			(i==0 ? boundheadvars : freeheadvars).insert(it->second);
+			headvars.insert(it->second);
+		}
+		lex.accept('(');
 	}
 
 	for(auto it=var2name.begin(); it!=var2name.end(); it++)
 		allvars.insert(it->first);
 
-	assert(goals.size()>0);
-
 	compute_extrafeatures();
+	return true;
+}
+
+Expression Expression::parse(const std::string& expr, 
+	const map<std::string, const BaseRelation*>& name2br, ParseError& error) {
+	return parse(expr.data(), expr.data()+expr.size(), name2br, error);
+}
+
+Expression Expression::parse(const char* begin, const char* end, 
+	const map<std::string, const BaseRelation*>& name2br, ParseError& error) {
+	Expression result;
+	error = ParseError();
+	if(!result.parse_into(begin, end, name2br, error))
+		return Expression();
+	return result;
+}
+
+namespace {
+
+/**Parses the character ranges in [first, last) of ranges into the matching slots of results and errors*/
+void parse_ranges(const vector<pair<const char*, const char*>>& ranges, uint first, uint last,
+	const map<std::string, const BaseRelation*>& name2br, vector<Expression>& results, 
+	vector<Expression::ParseError>& errors) {
+	for(uint i=first; i<last; i++)
+		results[i] = Expression::parse(ranges[i].first, ranges[i].second, name2br, errors[i]);
+}
+
+/**Ranges are partitioned into contiguous chunks, one per thread, and every thread writes into 
+its own slots so that the output does not depend on scheduling.*/
+vector<Expression> parse_ranges_parallel(const vector<pair<const char*, const char*>>& ranges, 
+	const vector<int>& lines, const map<std::string, const BaseRelation*>& name2br, 
+	vector<Expression::ParseError>& errors, uint num_threads, const Expression& empty) {
+	if(num_threads==0) 
+		num_threads = max(1u, std::thread::hardware_concurrency());
+	num_threads = max(1u, min(num_threads, (uint) ranges.size()));
+	vector<Expression> results(ranges.size(), empty);
+	vector<Expression::ParseError> all_errors(ranges.size());
+
+	uint chunk = (ranges.size()+num_threads-1)/max(1u, num_threads);
+	vector<std::thread> workers;
+	for(uint t=1; t<num_threads; t++) 
+		workers.push_back(std::thread(parse_ranges, std::cref(ranges), min(t*chunk, (uint) ranges.size()),
+			min((t+1)*chunk, (uint) ranges.size()), std::cref(name2br), std::ref(results), std::ref(all_errors)));
+	parse_ranges(ranges, 0, min(chunk, (uint) ranges.size()), name2br, results, all_errors);
+	for(auto& worker: workers)
+		worker.join();
+
+	vector<Expression> parsed;
+	for(uint i=0; i<ranges.size(); i++) {
+		if(all_errors[i].pos>=0) {
+			all_errors[i].line = lines[i];
+			errors.push_back(all_errors[i]);
+		}
+		else
+			parsed.push_back(results[i]);
+	}
+	return parsed;
+}
+
+}
+
+vector<Expression> Expression::parse_batch(const vector<std::string>& exprs,
+	const map<std::string, const BaseRelation*>& name2br, 
+	vector<ParseError>& errors, uint num_threads) {
+	vector<pair<const char*, const char*>> ranges;
+	vector<int> lines;
+	for(uint i=0; i<exprs.size(); i++) {
+		ranges.push_back(make_pair(exprs[i].data(), exprs[i].data()+exprs[i].size()));
+		lines.push_back(i);
+	}
+	return parse_ranges_parallel(ranges, lines, name2br, errors, num_threads, Expression());
+}
+
+vector<Expression> Expression::parse_workload(const std::string& filename,
+	const map<std::string, const BaseRelation*>& name2br, 
+	vector<ParseError>& errors, uint num_threads) {
+	std::ifstream file(filename);
+	if(!file.is_open()) {
+		ParseError error;
+		error.pos = 0;
+		error.message = "cannot open workload file '"+filename+"'";
+		errors.push_back(error);
+		return vector<Expression>();
+	}
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	const string contents = buffer.str();
+
+	vector<pair<const char*, const char*>> ranges;
+	vector<int> lines;
+	const char* cur = contents.data();
+	const char* end = contents.data()+contents.size();
+	int line=1;
+	while(cur<end) {
+		const char* eol = std::find(cur, end, '\n');
+		const char* first = cur;
+		while(first!=eol && is_space(*first)) first++;
+		if(first!=eol && *first!='#') {
+			ranges.push_back(make_pair(cur, eol));
+			lines.push_back(line);
+		}
+		cur = eol+1;
+		line++;
+	}
+	return parse_ranges_parallel(ranges, lines, name2br, errors, num_threads, Expression());
 }
 
 
@@ -195,7 +437,7 @@ string Expression::show() const {
 }
 
 Expression::Expression() :
-name(""), name2var(), var2name(), var2dtype(), goals(), boundheadvars(), freeheadvars(), headvars() {}
+name(""), name2var(), var2name(), var2dtype(), goals(), boundheadvars(), freeheadvars(), headvars(), fprint(0) {}
 
 Expression Expression::subexpression(const std::set<int>& subset_goals) const {
 	assert(subset_goals.size()>0);
@@ -273,12 +515,14 @@ map<int, string> Expression::Table::execute_goal(DataFrame& result,
 				var2cid[var] = result.self_join(var2cid.at(var), pos2cid.at(i));
 		}
 	}
+	for(uint i=expr->goals[gid].symbols.size(); i<pos2cid.size(); i++)
+		gid2extra_cids[gid].push_back(pos2cid.at(i));
 	return var2cid;
 }
 
 Expression::Table::Table(const Expression* exp_arg, 
 	std::map<const BaseRelation*, 
-	const BaseRelation::Table*> br2table) 
+	const BaseRelation::Table*> br2table, bool keep_all_vars) 
 : exp(exp_arg), df(vector<ColumnMetaData>(), vector<vector<Data>>()){
 
 	auto empty_df=df;
@@ -316,10 +560,16 @@ Expression::Table::Table(const Expression* exp_arg,
 
 	for(auto item: allvar2cid) {
 		auto var=item.first;
-		if(exp->headvars.find(var)==exp->headvars.end())
-			df.project_out(allvar2cid.at(var));
-		else
+		if(exp->headvars.find(var)==exp->headvars.end()) {
+			if(keep_all_vars)
+				var2cid[var] = allvar2cid.at(var);
+			else
+				df.project_out(allvar2cid.at(var));
+		}
+		else {
 			headvar2cid[var] = allvar2cid.at(var);
+			var2cid[var] = allvar2cid.at(var);
+		}
 	}
 }
 
@@ -342,7 +592,19 @@ void Expression::compute_extrafeatures() {
 		}
 	}
 
+	goal_adjacency.clear();
+	if(goals.size()<=esutils::max_mask_size) {
+		goal_adjacency.resize(goals.size(), 0);
+		for(auto& var_goals: var2goals) {
+			uint64_t mask = esutils::set_to_mask(var_goals.second);
+			for(auto gid: var_goals.second)
+				goal_adjacency[gid] |= mask;
+		}
+	}
+
 	compute_sketch();
+	compute_invariants();
+	compute_fingerprint();
 
 	// computing join_merge_sketch
 	map<string, int> br_name2count;
@@ -402,12 +664,78 @@ void Expression::compute_sketch() {
 	sketch += "}";
 }
 
+Expression::Invariants::Invariants() : relation_signature(0), constant_signature(0) {}
+
+void Expression::compute_invariants() {
+	invars = Invariants();
+	for(const auto& goal: goals) {
+		invars.relations.push_back(goal.br);
+		invars.relation_signature |= uint64_t(1)<<(goal.br->get_id()%64);
+		vector<int> pattern(goal.symbols.size(), -1);
+		for(uint i=0; i<goal.symbols.size(); i++) {
+			const auto& symbol = goal.symbols[i];
+			if(symbol.isconstant) {
+				invars.constants.push_back(symbol.dt);
+				size_t hash = (symbol.dt.get_dtype()==Dtype::Int ? 
+					std::hash<int>()(symbol.dt.get_int_val()) : std::hash<string>()(symbol.dt.get_str_val()));
+				invars.constant_signature |= uint64_t(1)<<(hash%64);
+				continue;
+			}
+			pattern[i] = i;
+			for(uint j=0; j<i; j++)
+				if(goal.symbols[j]==symbol) {
+					pattern[i] = j;
+					break;
+				}
+		}
+		invars.goal_patterns.push_back(make_pair(goal.br, pattern));
+	}
+	std::sort(invars.relations.begin(), invars.relations.end());
+	invars.relations.erase(std::unique(invars.relations.begin(), invars.relations.end()), invars.relations.end());
+	std::sort(invars.constants.begin(), invars.constants.end());
+	invars.constants.erase(std::unique(invars.constants.begin(), invars.constants.end()), invars.constants.end());
+	std::sort(invars.goal_patterns.begin(), invars.goal_patterns.end());
+	invars.goal_patterns.erase(std::unique(invars.goal_patterns.begin(), invars.goal_patterns.end()), 
+		invars.goal_patterns.end());
+}
+
+void Expression::compute_fingerprint() {
+	structure = "[";
+	for(auto var: boundheadvars)
+		structure += to_string(var)+",";
+	structure += "](";
+	for(auto var: freeheadvars)
+		structure += to_string(var)+",";
+	structure += ")";
+	for(const auto& goal: goals) {
+		structure += to_string(goal.br->get_id())+"(";
+		for(const auto& symbol: goal.symbols)
+			structure += (symbol.isconstant ? symbol.dt.show() : to_string(symbol.var)) + ",";
+		structure += ")";
+	}
+	fprint = std::hash<string>()(structure);
+}
+
+uint64_t Expression::fingerprint() const {
+	return fprint;
+}
+
+const string& Expression::get_structure() const {
+	return structure;
+}
+
+const Expression::Invariants& Expression::invariants() const {
+	return invars;
+}
+
 const set<int>& Expression::goals_containing(int var) const {
 	return var2goals.at(var);
 }
 
 bool Expression::connected(const set<int>& subset_goals) const {
 	if(subset_goals.size()==0) return false;
+	if(goals.size()<=esutils::max_mask_size)
+		return connected(esutils::set_to_mask(subset_goals));
 	set<int> uncovered_goals = subset_goals;
 	queue<int> gids;
 	gids.push(*(uncovered_goals.begin()));
@@ -430,6 +758,26 @@ bool Expression::connected(const set<int>& subset_goals) const {
 	return true;
 }
 
+bool Expression::connected(uint64_t subset_goals) const {
+	assert(goals.size()<=esutils::max_mask_size);
+	if(subset_goals==0) return false;
+	uint64_t reached = subset_goals & (~subset_goals+1);
+	uint64_t frontier = reached;
+	while(frontier!=0) {
+		int gid = __builtin_ctzll(frontier);
+		frontier &= frontier-1;
+		uint64_t newgoals = goal_adjacency.at(gid) & subset_goals & ~reached;
+		reached |= newgoals;
+		frontier |= newgoals;
+	}
+	return reached==subset_goals;
+}
+
+esutils::ConnectedSubsets Expression::connected_subsets(uint max_size) const {
+	assert(goals.size()<=esutils::max_mask_size);
+	return esutils::ConnectedSubsets(goal_adjacency, max_size);
+}
+
 const string& Expression::get_sketch() const {
 	return sketch;
 }
@@ -443,12 +791,14 @@ void Expression::drop_headvar(int headvar) {
 	if(boundheadvars.find(headvar)!=boundheadvars.end())
 		boundheadvars.erase(headvar);
 	compute_sketch();
+	compute_fingerprint();
 }
 
 void Expression::make_headvar_bound(int headvar) {
 	assert(freeheadvars.find(headvar)!=freeheadvars.end());
 	freeheadvars.erase(headvar);
 	boundheadvars.insert(headvar);
+	compute_fingerprint();
 }
 
 void Expression::select(int var, Data dt) {
@@ -615,6 +965,154 @@ Expression Expression::merge_with(const Expression& exp) const {
 	return result;
 }
 
+SampleEstimator::SampleEstimator(const map<const BaseRelation*, const BaseRelation::Table*>& br2table,
+	double time_budget_arg, uint min_sample_tuples_arg): time_budget(time_budget_arg), 
+min_sample_tuples(min_sample_tuples_arg) {
+	for(auto& kv: br2table)
+		br2sample[kv.first] = kv.second->df.get_rows();
+}
+
+std::shared_ptr<const SampleEstimator::Result> SampleEstimator::execute(const Expression& exp) const {
+	set<const BaseRelation*> brs;
+	set<int> gids;
+	for(int gid=0; gid<exp.num_goals(); gid++) {
+		brs.insert(exp.goal_at(gid).br);
+		gids.insert(gid);
+	}
+	for(auto br: brs)
+		if(br2sample.find(br)==br2sample.end() || br2sample.at(br).empty())
+			return nullptr;
+	if(!exp.connected(gids))
+		return nullptr;
+
+	auto start = std::chrono::steady_clock::now();
+	double last_round_time = 0;
+	std::shared_ptr<Result> result;
+	for(size_t num_rows=256; ; num_rows*=2) {
+		auto round_start = std::chrono::steady_clock::now();
+		// prefixes of the samples carry the position of each tuple in an extra column, so that the 
+		// base tuples joined by a result row can be told apart
+		map<const BaseRelation*, BaseRelation::Table> tables;
+		map<const BaseRelation*, const BaseRelation::Table*> br2table;
+		map<const BaseRelation*, double> br2fraction;
+		bool complete = true;
+		for(auto br: brs) {
+			const auto& sample = br2sample.at(br);
+			size_t size = min(num_rows, sample.size());
+			complete = complete && size==sample.size();
+			auto& table = tables.emplace(br, BaseRelation::Table(br, "s")).first->second;
+			auto header = table.df.get_header();
+			header.push_back(ColumnMetaData("s_"+to_string(header.size()), Dtype::Int));
+			vector<vector<Data>> tuples(sample.begin(), sample.begin()+size);
+			for(uint i=0; i<size; i++)
+				tuples[i].push_back(Data(int(i)));
+			table.df = DataFrame(header, tuples);
+			br2table[br] = &table;
+			br2fraction[br] = min(1.0, size/br->num_tuples());
+		}
+
+		Expression::Table exp_table(&exp, br2table, true);
+		result = std::make_shared<Result>();
+		result->rows = exp_table.df.get_rows();
+		for(auto& kv: exp_table.var2cid)
+			result->var2pos[kv.first] = exp_table.df.get_cid2pos(kv.second);
+		vector<pair<int, const BaseRelation*>> rowid_cols;
+		for(auto& kv: exp_table.gid2extra_cids)
+			rowid_cols.push_back(make_pair(exp_table.df.get_cid2pos(kv.second.front()), 
+				exp.goal_at(kv.first).br));
+		result->fractions = br2fraction;
+		for(auto& row: result->rows) {
+			set<pair<const BaseRelation*, int>> base_tuples;
+			for(auto& col: rowid_cols)
+				base_tuples.insert(make_pair(col.second, row[col.first].get_int_val()));
+			double inclusion = 1;
+			for(auto& base_tuple: base_tuples)
+				inclusion *= br2fraction.at(base_tuple.first);
+			result->inclusion.push_back(inclusion);
+			result->base_tuples.emplace_back(base_tuples.begin(), base_tuples.end());
+		}
+
+		// the next round joins prefixes twice as long, so it takes at least twice as long as this one, 
+		// and longer if the rounds so far grew faster. It only starts if it is expected to end in time
+		auto now = std::chrono::steady_clock::now();
+		double round_time = std::chrono::duration<double>(now-round_start).count();
+		double elapsed = std::chrono::duration<double>(now-start).count();
+		double growth = (last_round_time>0 ? max(2.0, round_time/last_round_time) : 2.0);
+		if(complete || elapsed+growth*round_time>time_budget)
+			break;
+		last_round_time = round_time;
+	}
+	return result;
+}
+
+bool SampleEstimator::sparse(const Result& result) const {
+	return result.rows.size()<min_sample_tuples;
+}
+
+SampleEstimator::Estimate SampleEstimator::num_tuples(const Result& result) const {
+	// rows i and j are both sampled with probability inclusion_i*inclusion_j over the product p(A) of 
+	// the fractions of the base tuples A they share, so the variance is the sum over the pairs of 
+	// (1-p(A))/(inclusion_i*inclusion_j). As 1-p(A) is the sum over the nonempty subsets S of A of 
+	// (-1)^(|S|+1) times the product of 1-fraction over S, the variance is the sum over the subsets 
+	// S of base tuples of that term times the square of the sum of 1/inclusion over the rows joining S
+	double value = 0, variance = 0;
+	map<vector<pair<const BaseRelation*, int>>, double> subset2weight;
+	for(uint i=0; i<result.rows.size(); i++) {
+		value += 1/result.inclusion[i];
+		const auto& base_tuples = result.base_tuples[i];
+		for(uint64_t mask=1; mask<(uint64_t(1)<<base_tuples.size()); mask++) {
+			vector<pair<const BaseRelation*, int>> subset;
+			for(uint b=0; b<base_tuples.size(); b++)
+				if(mask&(uint64_t(1)<<b))
+					subset.push_back(base_tuples[b]);
+			subset2weight[subset] += 1/result.inclusion[i];
+		}
+	}
+	for(auto& kv: subset2weight) {
+		double term = (kv.first.size()%2==1 ? 1 : -1);
+		for(auto& base_tuple: kv.first)
+			term *= 1-result.fractions.at(base_tuple.first);
+		variance += term*kv.second*kv.second;
+	}
+	double margin = 1.96*std::sqrt(max(0.0, variance));
+	return Estimate{value, max(0.0, value-margin), value+margin};
+}
+
+SampleEstimator::Estimate SampleEstimator::num_distinct(const Result& result, 
+	const vector<int>& vars) const {
+	if(vars.empty())
+		return Estimate{1, 1, 1};
+	map<vector<Data>, pair<uint, double>> combination2count;  //!< count and inclusion of the first row
+	for(uint i=0; i<result.rows.size(); i++) {
+		vector<Data> combination;
+		for(auto var: vars)
+			combination.push_back(result.rows[i][result.var2pos.at(var)]);
+		auto it = combination2count.find(combination);
+		if(it==combination2count.end())
+			combination2count.emplace(std::move(combination), make_pair(1u, result.inclusion[i]));
+		else
+			it->second.first++;
+	}
+	// Shlosser's estimator with the fraction of result tuples that were sampled, the bounds take each
+	// combination seen once as the only one seen of 1/inclusion combinations
+	double fraction = min(1.0, result.rows.size()/num_tuples(result).value);
+	map<uint, double> count2num;
+	Estimate estimate{0, 0, 0};
+	for(auto& kv: combination2count) {
+		count2num[kv.second.first]++;
+		estimate.low += 1;
+		estimate.high += (kv.second.first==1 ? 1/kv.second.second : 1);
+	}
+	double unseen = 0, seen = 0;
+	for(auto& kv: count2num) {
+		unseen += std::pow(1-fraction, kv.first)*kv.second;
+		seen += kv.first*fraction*std::pow(1-fraction, kv.first-1)*kv.second;
+	}
+	estimate.value = estimate.low + (seen>0 ? count2num[1]*unseen/seen : 0);
+	estimate.value = min(estimate.high, estimate.value);
+	return estimate;
+}
+
 set<int> all_goals(int n) {
 	set<int> s;
 	for(int i=0; i<n; i++)
@@ -622,11 +1120,11 @@ set<int> all_goals(int n) {
 	return s;
 }
 
-CardinalityEstimator::CardinalityEstimator(const Expression& exp_arg) :
-CardinalityEstimator(exp_arg, all_goals(exp_arg.num_goals())) {}
+CardinalityEstimator::CardinalityEstimator(const Expression& exp_arg, const SampleEstimator* sampler_arg) :
+CardinalityEstimator(exp_arg, all_goals(exp_arg.num_goals()), sampler_arg) {}
 
 CardinalityEstimator::CardinalityEstimator(const Expression& exp_arg,
-		const set<int>& goals_arg) : exp(exp_arg) {
+		const set<int>& goals_arg, const SampleEstimator* sampler_arg) : exp(exp_arg), sampler(sampler_arg) {
 
 	for(auto gid: goals_arg) 
 		add_goal(gid);
@@ -644,19 +1142,184 @@ void CardinalityEstimator::add_goal(int gid) {
 	if(goals.find(gid)!=goals.end())
 		return;
 	auto goal = exp.goal_at(gid);
-	ExtremeFraction x, n;
+	LogFraction x, n;
+	map<int, double> old_cards;  //!< cardinalities of the goal's variables before the goal, those of its columns for new variables
+	n.multiply(goal.br->num_tuples());
+	set<int> var_cols;
 	for(int i=0; i<goal.br->get_num_cols(); i++) {
-		x.divide(goal.br->card_at(i));
 		auto symbol = goal.symbols.at(i);
+		if(!symbol.isconstant) var_cols.insert(i);
+		// with statistics, the tuples matching a constant are counted instead of assuming uniform 
+		// values, so goals on frequent constants match many more tuples than goals on rare ones
+		if(symbol.isconstant && goal.br->has_statistics()) {
+			n.multiply(max(1.0, goal.br->value_count(i, symbol.dt)));
+			n.divide(goal.br->num_tuples());
+		}
+		else
+			x.divide(goal.br->card_at(i));
 		if(!symbol.isconstant) {
 			if(var2card.find(symbol.var)==var2card.end())
 				var2card[symbol.var] = goal.br->card_at(i);
+			old_cards.emplace(symbol.var, var2card[symbol.var]);
 			var2card[symbol.var] = min(var2card[symbol.var], goal.br->card_at(i));
 		}
 	}
-	n.multiply(goal.br->num_tuples());
 	goal2selectivity[gid] = max(0.0, min(1.0, 1-OneMinusXN(x, n)));
+	// columns are assumed independent unless the relation knows the distinct value combinations of the 
+	// goal's variable columns. The matching tuples then hold the same share of distinct combinations
+	// as the whole relation, which captures correlated and duplicated values
+	if(var_cols.size()>=2 && goal.br->has_statistics() && goal.br->has_joint_card(var_cols)) {
+		n.multiply(goal.br->joint_card(var_cols));
+		n.divide(goal.br->num_tuples());
+		n.multiply(x);
+		goal2selectivity[gid] = n.eval(1e-300, 1);
+	}
 	goals.insert(gid);
+	memo.clear();
+	var2split_factors.clear();
+	sample.reset();
+	sample_executed = false;
+
+	// goals with constants only never join with anything
+	if(old_cards.empty())
+		return;
+	set<int> roots;
+	for(auto& kv: old_cards) {
+		int var = kv.first;
+		if(var2parent.find(var)==var2parent.end()) {
+			var2parent[var] = var;
+			auto& component = root2component[var];
+			component.vars.push_back(var);
+			component.n.multiply(var2card.at(var));
+		}
+		else if(var2card.at(var)!=kv.second) {
+			auto& component = root2component.at(find_root(var));
+			component.n.divide(kv.second);
+			component.n.multiply(var2card.at(var));
+		}
+		roots.insert(find_root(var));
+	}
+	// union by size into the largest component
+	int root = *roots.begin();
+	for(auto r: roots)
+		if(root2component.at(r).vars.size()>root2component.at(root).vars.size())
+			root = r;
+	auto& component = root2component.at(root);
+	for(auto r: roots) {
+		if(r==root) continue;
+		auto& other = root2component.at(r);
+		component.vars.insert(component.vars.end(), other.vars.begin(), other.vars.end());
+		component.goals.insert(component.goals.end(), other.goals.begin(), other.goals.end());
+		component.x.multiply(other.x);
+		component.n.multiply(other.n);
+		var2parent[r] = root;
+		root2component.erase(r);
+	}
+	component.goals.push_back(gid);
+	component.x.multiply(goal2selectivity.at(gid));
+	component.factor = max(0.0, min(1.0, 1-OneMinusXN(component.x, component.n)));
+}
+
+namespace {
+
+/**Depth-first search for the articulation points of a component of the graph linking the goals and 
+the variables they contain. For each variable it collects the pieces that get cut off from the rest 
+of the component when the variable is removed, with the products of their goal selectivities and 
+variable cardinalities*/
+class SplitSearch {
+public:
+	struct Piece {
+		LogFraction x;
+		LogFraction n;
+		bool lonely;  //!< a single goal holding no variable but the one removed
+	};
+	std::map<int, std::vector<Piece>> var2pieces;
+private:
+	const Expression& exp;
+	const set<int>& goals;
+	const map<int, double>& goal2selectivity;
+	const map<int, double>& var2card;
+	map<int, int> var_disc, goal_disc;
+	int time = 0;
+
+	int visit_var(int var, int parent_gid, LogFraction& x, LogFraction& n) {
+		int low = var_disc[var] = time++;
+		n.multiply(var2card.at(var));
+		for(int gid: exp.goals_containing(var)) {
+			if(gid==parent_gid || goals.find(gid)==goals.end()) continue;
+			if(goal_disc.find(gid)!=goal_disc.end()) {
+				low = min(low, goal_disc.at(gid));
+				continue;
+			}
+			Piece piece {LogFraction(), LogFraction(), true};
+			int goal_low = visit_goal(gid, var, piece.x, piece.n);
+			low = min(low, goal_low);
+			x.multiply(piece.x);
+			n.multiply(piece.n);
+			if(goal_low>=var_disc.at(var)) {
+				for(auto& symbol: exp.goal_at(gid).symbols)
+					piece.lonely = piece.lonely && (symbol.isconstant || symbol.var==var);
+				var2pieces[var].push_back(piece);
+			}
+		}
+		return low;
+	}
+
+	int visit_goal(int gid, int parent_var, LogFraction& x, LogFraction& n) {
+		int low = goal_disc[gid] = time++;
+		x.multiply(goal2selectivity.at(gid));
+		for(auto& symbol: exp.goal_at(gid).symbols) {
+			if(symbol.isconstant || symbol.var==parent_var) continue;
+			if(var_disc.find(symbol.var)!=var_disc.end())
+				low = min(low, var_disc.at(symbol.var));
+			else
+				low = min(low, visit_var(symbol.var, gid, x, n));
+		}
+		return low;
+	}
+public:
+	SplitSearch(const Expression& exp_arg, const set<int>& goals_arg, 
+		const map<int, double>& goal2selectivity_arg, const map<int, double>& var2card_arg) : 
+		exp(exp_arg), goals(goals_arg), goal2selectivity(goal2selectivity_arg), var2card(var2card_arg) {}
+
+	void run(int root_var) {
+		LogFraction x, n;
+		visit_var(root_var, -1, x, n);
+	}
+};
+
+}
+
+void CardinalityEstimator::compute_split_factors() const {
+	for(auto& kv: root2component) {
+		const auto& component = kv.second;
+		SplitSearch search(exp, goals, goal2selectivity, var2card);
+		search.run(component.vars.front());
+		for(auto var: component.vars) {
+			// the pieces cut off below var in the search and, unless var is where it started, the rest
+			LogFraction rest_x = component.x, rest_n = component.n;
+			rest_n.divide(var2card.at(var));
+			double selected_factor = 1, lonely_factor = 1;
+			for(auto& piece: search.var2pieces[var]) {
+				double factor = max(0.0, min(1.0, 1-OneMinusXN(piece.x, piece.n)));
+				(piece.lonely ? lonely_factor : selected_factor) *= factor;
+				rest_x.divide(piece.x);
+				rest_n.divide(piece.n);
+			}
+			if(var!=component.vars.front())
+				selected_factor *= max(0.0, min(1.0, 1-OneMinusXN(rest_x, rest_n)));
+			var2split_factors[var] = make_pair(selected_factor*lonely_factor, selected_factor);
+		}
+	}
+}
+
+int CardinalityEstimator::find_root(int var) const {
+	int parent = var2parent.at(var);
+	while(parent!=var) {
+		var = parent;
+		parent = var2parent.at(var);
+	}
+	return var;
 }
 
 vector<double> CardinalityEstimator::get_cardinalities(const vector<int>& varids) const {
@@ -665,46 +1328,105 @@ vector<double> CardinalityEstimator::get_cardinalities(const vector<int>& varids
 
 vector<double> CardinalityEstimator::get_cardinalities(const vector<int>& varids,
 	const set<int>& pre_select_vars) const {
-	set<int> select_vids;
+	BitSet selected_vars;
+	for(auto var: pre_select_vars)
+		selected_vars.insert(var);
 	vector<double> result;
 	for(auto varid: varids) {
-		double card = var2card.at(varid);
-		select_vids.insert(varid);
-		set<int> remaining_goals = goals;
-		while(!remaining_goals.empty()) {
-			set<int> considered_vars;
-			queue<int> considered_goals;
-			considered_goals.push(*remaining_goals.begin());
-			remaining_goals.erase(remaining_goals.begin());
-			ExtremeFraction x, n;
-			while(!considered_goals.empty()) {
-				int gid = considered_goals.front();
-				considered_goals.pop();
-				bool apply_goal=false;
-				for(auto symbol: exp.goal_at(gid).symbols) {
-					if(symbol.isconstant) continue;
-					int var = symbol.var;
-					if(var==varid) apply_goal=true;
-					if(select_vids.find(var)==select_vids.end() &&
-						pre_select_vars.find(var)==pre_select_vars.end()) {
-						apply_goal = true;
-						if(considered_vars.find(var)==considered_vars.end())
-							n.multiply(var2card.at(var));
-						considered_vars.insert(var);
-						for(auto g: exp.goals_containing(var))
-							if(remaining_goals.find(g)!=remaining_goals.end()) {
-								remaining_goals.erase(g);
-								considered_goals.push(g);
-							}
-					}
+		selected_vars.insert(varid);
+		memo_lookups++;
+		auto key = make_pair(varid, selected_vars);
+		auto it = memo.find(key);
+		if(it!=memo.end())
+			memo_hits++;
+		else
+			it = memo.emplace(std::move(key), cardinality(varid, selected_vars)).first;
+		result.push_back(it->second);
+	}
+	return result;
+}
+
+const SampleEstimator::Result* CardinalityEstimator::sample_result() const {
+	if(sampler==nullptr || ((int)goals.size())!=exp.num_goals())
+		return nullptr;
+	if(!sample_executed) {
+		sample = sampler->execute(exp);
+		sample_executed = true;
+	}
+	if(!sample || sampler->sparse(*sample))
+		return nullptr;
+	return sample.get();
+}
+
+/**the cardinality of varid is its maximum cardinality scaled down by the probability that a value 
+joins in each connected component of the considered goals, where components are linked through the 
+variables that are not selected*/
+double CardinalityEstimator::cardinality(int varid, const BitSet& selected_vars) const {
+	// over a sampled result, the cardinality is the average number of values of varid per 
+	// combination of the selected variables
+	if(auto result = sample_result()) {
+		vector<int> vars;
+		for(auto var: selected_vars)
+			if(((int)var)!=varid && result->var2pos.find(var)!=result->var2pos.end())
+				vars.push_back(var);
+		double num_selected = sampler->num_distinct(*result, vars).value;
+		vars.push_back(varid);
+		if(num_selected>0)
+			return sampler->num_distinct(*result, vars).value/num_selected;
+	}
+	double card = var2card.at(varid);
+	// a component without selected variables stays whole and one with a single selected variable 
+	// falls into the pieces found by the articulation search, so their products are precomputed. 
+	// Only the components holding several selected variables are searched
+	if(var2split_factors.empty())
+		compute_split_factors();
+	map<int, vector<int>> root2selected;
+	for(auto var: selected_vars)
+		if(var2parent.find(var)!=var2parent.end())
+			root2selected[find_root(var)].push_back(var);
+	set<int> remaining_goals;
+	for(auto& kv: root2component) {
+		auto it = root2selected.find(kv.first);
+		if(it==root2selected.end())
+			card *= kv.second.factor;
+		else if(it->second.size()==1) {
+			const auto& factors = var2split_factors.at(it->second.front());
+			card *= (it->second.front()==varid ? factors.first : factors.second);
+		}
+		else
+			remaining_goals.insert(kv.second.goals.begin(), kv.second.goals.end());
+	}
+	while(!remaining_goals.empty()) {
+		set<int> considered_vars;
+		queue<int> considered_goals;
+		considered_goals.push(*remaining_goals.begin());
+		remaining_goals.erase(remaining_goals.begin());
+		LogFraction x, n;
+		while(!considered_goals.empty()) {
+			int gid = considered_goals.front();
+			considered_goals.pop();
+			bool apply_goal=false;
+			for(auto symbol: exp.goal_at(gid).symbols) {
+				if(symbol.isconstant) continue;
+				int var = symbol.var;
+				if(var==varid) apply_goal=true;
+				if(!selected_vars.contains(var)) {
+					apply_goal = true;
+					if(considered_vars.find(var)==considered_vars.end())
+						n.multiply(var2card.at(var));
+					considered_vars.insert(var);
+					for(auto g: exp.goals_containing(var))
+						if(remaining_goals.find(g)!=remaining_goals.end()) {
+							remaining_goals.erase(g);
+							considered_goals.push(g);
+						}
 				}
-				if (apply_goal) x.multiply(goal2selectivity.at(gid));
 			}
-			card *= max(0.0, min(1.0, 1-OneMinusXN(x, n)));
+			if (apply_goal) x.multiply(goal2selectivity.at(gid));
 		}
-		result.push_back(card);
+		card *= max(0.0, min(1.0, 1-OneMinusXN(x, n)));
 	}
-	return result;
+	return card;
 }
 
 double CardinalityEstimator::var_card(int var) const {
@@ -1,6 +1,5 @@
 #include "query.h"
 #include "data.h"
-#include "dataframe.h"
 #include "expression.h"
 #include "utils.h"
 
@@ -28,6 +27,7 @@ using std::sort;
 using std::pair;
 using std::make_pair;
 using esutils::random_number_generator;
+using esutils::BitSet;
 
 vector<int> get_goal_order(const Expression& qexpr) {
 	CardinalityEstimator E(qexpr, set<int>());
@@ -70,54 +70,157 @@ vector<int> get_goal_order(const Expression& qexpr) {
 	return goal_order;
 }
 
-Query::Query(const Expression& exp_arg, double wgt)
-: exp(exp_arg), wt(wgt) {
-	assert(!exp.empty());
-	map<const BaseRelation*, BaseRelation::Table*> br2tab;
-	map<int, Data> var2const;
-	int maxconst=0;
-	set<Data> consts;
-	for(int gid=0; gid<exp.num_goals(); gid++) 
-		for(uint i=0; i<exp.goal_at(gid).symbols.size(); i++) 
-			if(exp.goal_at(gid).symbols.at(i).isconstant)
-				consts.insert(exp.goal_at(gid).symbols.at(i).dt);
+namespace {
+
+/**Enumerates isomorphisms from the body src onto the body dest. Goals of src are mapped in order, 
+each onto an unused goal of dest over the same relation, and symbols are mapped one-to-one, constants 
+onto equal constants and variables onto variables with the same role*/
+class IsomorphismSearch {
+	const Query::Body& src;
+	const Query::Body& dest;
+	std::vector<int> perm, inv;  //!< symbol map and its inverse, -1 where unset
+	std::vector<int> goal_perm;
+	std::vector<bool> used_goals;
+	bool skip_identity;
+	std::vector<Query::Isomorphism>& result;
+	uint max_count;
+
+	void search(uint gid) {
+		if(result.size()>=max_count)
+			return;
+		if(gid==src.goal_sids.size()) {
+			bool identity = skip_identity;
+			for(uint sid=0; sid<perm.size() && identity; sid++)
+				identity = (perm[sid]==(int) sid);
+			if(!identity)
+				result.push_back(Query::Isomorphism{perm, goal_perm});
+			return;
+		}
+		const auto& sids = src.goal_sids[gid];
+		auto it = dest.br2goals.find(src.goal_brs[gid]);
+		if(it==dest.br2goals.end())
+			return;
+		vector<int> newly_set;
+		for(int dest_gid: it->second) {
+			if(used_goals[dest_gid]) continue;
+			const auto& dest_sids = dest.goal_sids[dest_gid];
+			bool match = true;
+			for(uint i=0; i<sids.size() && match; i++) {
+				int s = sids[i], d = dest_sids[i];
+				if(perm[s]<0 && inv[d]<0 && src.roles[s]==dest.roles[d] 
+					&& (src.roles[s]!=0 || src.symbols[s].dt==dest.symbols[d].dt)) {
+					perm[s] = d;  inv[d] = s;
+					newly_set.push_back(s);
+				}
+				else
+					match = (perm[s]==d);
+			}
+			if(match) {
+				used_goals[dest_gid] = true;  goal_perm[gid] = dest_gid;
+				search(gid+1);
+				used_goals[dest_gid] = false;
+			}
+			for(auto s: newly_set) {
+				inv[perm[s]] = -1;  perm[s] = -1;
+			}
+			newly_set.clear();
+		}
+	}
+public:
+	IsomorphismSearch(const Query::Body& src_arg, const Query::Body& dest_arg, 
+		std::vector<Query::Isomorphism>& result_arg, uint max_count_arg) :
+		src(src_arg), dest(dest_arg), perm(src_arg.symbols.size(), -1), inv(dest_arg.symbols.size(), -1), 
+		goal_perm(src_arg.goal_sids.size(), -1), used_goals(dest_arg.goal_sids.size(), false), 
+		skip_identity(&src_arg==&dest_arg), result(result_arg), max_count(max_count_arg) {}
+
+	void run() {
+		if(src.symbols.size()==dest.symbols.size() && src.goal_sids.size()==dest.goal_sids.size())
+			search(0);
+	}
+};
 
+}
+
+Query::Body::Body(const Expression& exp) {
 	for(int gid=0; gid<exp.num_goals(); gid++) {
-		auto goal = exp.goal_at(gid);
-		if(br2tab.find(goal.br)==br2tab.end()) {
-			tables.push_back(BaseRelation::Table(goal.br, goal.br->get_name()));
-			br2tab[goal.br] = &tables.back();
-		}
-		auto table = br2tab.at(goal.br);
-		vector<Data> row;
-		for(uint i=0; i<goal.symbols.size(); i++) {
-			auto symbol = goal.symbols.at(i);
-			if(symbol.isconstant)
-				row.push_back(symbol.dt);
+		const auto& goal = exp.goal_at(gid);
+		br2goals[goal.br].push_back(gid);
+		goal_brs.push_back(goal.br);
+		goal_sids.push_back(vector<int>());
+		for(const auto& symbol: goal.symbols) {
+			if(symbol.isconstant) {
+				if(const2sid.find(symbol.dt)==const2sid.end()) {
+					const2sid.emplace(symbol.dt, symbols.size());
+					symbols.push_back(symbol);
+					roles.push_back(0);
+				}
+				goal_sids.back().push_back(const2sid.at(symbol.dt));
+			}
 			else {
-				if(var2const.find(symbol.var)==var2const.end()) {
-					if(goal.br->dtype_at(i)==Dtype::Int) {
-						while(consts.find(Data(maxconst++))!=consts.end()) {}
-						var2const.emplace(symbol.var, Data(maxconst-1));
-					}
-					else {
-						while(consts.find(Data(to_string(maxconst++)))!=consts.end()) {}
-						var2const.emplace(symbol.var, Data(to_string(maxconst-1)));
-					}
+				if(var2sid.find(symbol.var)==var2sid.end()) {
+					var2sid[symbol.var] = symbols.size();
+					symbols.push_back(symbol);
+					roles.push_back(exp.is_bound_headvar(symbol.var) ? 1 : exp.is_free_headvar(symbol.var) ? 2 : 3);
 				}
-				row.push_back(var2const.at(symbol.var));
+				goal_sids.back().push_back(var2sid.at(symbol.var));
 			}
 		}
-		table->df.add_tuple(row);
 	}
-	for(auto item: br2tab)
-		br2table[item.first] = item.second;
-	for(auto item: var2const)
-		const2var[item.second] = item.first;
+}
+
+int Query::Body::symbol_id(const Expression::Symbol& symbol) const {
+	return symbol.isconstant ? const2sid.at(symbol.dt) : var2sid.at(symbol.var);
+}
+
+vector<Query::Isomorphism> Query::Body::isomorphisms(const Body& dest, uint max_count) const {
+	vector<Isomorphism> result;
+	IsomorphismSearch(*this, dest, result, max_count).run();
+	return result;
+}
+
+Query::Query(const Expression& exp_arg, double wgt)
+: exp(exp_arg), body(exp), wt(wgt) {
+	assert(!exp.empty());
+
+	// bodies that are isomorphic have the same goal descriptions, in some order
+	const string role_names[] = {"", "b", "f", "n"};
+	vector<string> goal_descs;
+	for(int gid=0; gid<exp.num_goals(); gid++) {
+		string desc = to_string(body.goal_brs[gid]->get_id())+"(";
+		for(auto sid: body.goal_sids[gid])
+			desc += (body.roles[sid]==0 ? body.symbols[sid].dt.show() : role_names[body.roles[sid]]) + string(",");
+		goal_descs.push_back(desc+")");
+	}
+	sort(goal_descs.begin(), goal_descs.end());
+	ckey = to_string(body.symbols.size())+":";
+	for(const auto& desc: goal_descs)
+		ckey += desc;
 
 	g_order = get_goal_order(exp_arg);
 }
 
+const string& Query::class_key() const {
+	return ckey;
+}
+
+bool Query::find_isomorphism(const Query& dest, Isomorphism& iso) const {
+	if(ckey!=dest.ckey)
+		return false;
+	auto result = body.isomorphisms(dest.body, 1);
+	if(result.empty())
+		return false;
+	iso = result[0];
+	return true;
+}
+
+int Query::symbol_id(const Expression::Symbol& symbol) const {
+	return body.symbol_id(symbol);
+}
+
+const Expression::Symbol& Query::symbol_at(int sid) const {
+	return body.symbols.at(sid);
+}
+
 const vector<int>& Query::goal_order() const {
 	return g_order;
 }
@@ -133,28 +236,223 @@ string Query::show(bool verbose) const {
 	return result;
 }
 
-list<ViewTuple> Query::get_view_tuples(const Index& index) const {
-	for(int i=0; i<index.expression().num_goals(); i++)
-		if(br2table.find(index.expression().goal_at(i).br)==br2table.end())
-			return list<ViewTuple>();
+namespace {
+
+/**Enumerates containment maps from the goals of an index into the goals of a query by backtracking 
+over flat arrays. Index variables are renumbered densely into slots and the columns of index goals 
+refer either to a slot or to the query symbol of a constant. Only the images of the projected 
+variables are collected, so once all of them are bound one completion of the map is looked for, 
+since further ones would yield the same image*/
+class ViewTupleMatcher {
+	const std::vector<std::vector<int>>& query_goal_sids;
+	const std::map<const BaseRelation*, std::vector<int>>& query_br2goals;
+	std::vector<const std::vector<int>*> candidates;  //!< query goals over the relation of each index goal in goal order
+	std::vector<std::vector<int>> columns;  //!< slot (>=0) or -1-symbol id of each column of each index goal in goal order
+	std::vector<int> slot2sid;  //!< -1 if not bound yet
+	std::vector<int> head_slots;
+	std::vector<int> num_head_slots_bound;  //!< number of head slots bound before each goal
+	std::set<std::vector<int>> head_images;
+
+	bool search(uint pos, bool need_one) {
+		if(pos==columns.size()) {
+			vector<int> image;
+			for(auto slot: head_slots)
+				image.push_back(slot2sid[slot]);
+			head_images.insert(image);
+			return true;
+		}
+		if(!need_one && num_head_slots_bound[pos]==(int) head_slots.size()) {
+			vector<int> image;
+			for(auto slot: head_slots)
+				image.push_back(slot2sid[slot]);
+			if(head_images.find(image)!=head_images.end())
+				return true;
+			need_one = true;
+		}
+		const auto& cols = columns[pos];
+		vector<int> newly_bound;
+		bool found = false;
+		for(int qgid: *candidates[pos]) {
+			const auto& sids = query_goal_sids[qgid];
+			bool match = true;
+			for(uint i=0; i<cols.size() && match; i++) {
+				if(cols[i]<0) 
+					match = (-1-cols[i]==sids[i]);
+				else if(slot2sid[cols[i]]<0) {
+					slot2sid[cols[i]] = sids[i];
+					newly_bound.push_back(cols[i]);
+				}
+				else
+					match = (slot2sid[cols[i]]==sids[i]);
+			}
+			if(match && search(pos+1, need_one))
+				found = true;
+			for(auto slot: newly_bound)
+				slot2sid[slot] = -1;
+			newly_bound.clear();
+			if(found && need_one)
+				return true;
+		}
+		return found;
+	}
+public:
+	ViewTupleMatcher(const std::vector<std::vector<int>>& goal_sids_arg,
+		const std::map<const BaseRelation*, std::vector<int>>& br2goals_arg) : 
+		query_goal_sids(goal_sids_arg), query_br2goals(br2goals_arg) {}
+
+	/**returns false if some goal of iexp has no matching goal in the query. Goals are ordered so 
+	that each goal shares a variable with an earlier one whenever possible. Images are collected 
+	for projected_vars, which are head variables of iexp or of variants of it with the same body*/
+	bool prepare(const Expression& iexp, const std::map<Data, int>& const2sid, 
+		const std::set<int>& projected_vars) {
+		map<int, int> var2slot;
+		for(auto var: iexp.vars())
+			var2slot.emplace(var, var2slot.size());
+		slot2sid.assign(var2slot.size(), -1);
+		for(auto var: projected_vars)
+			head_slots.push_back(var2slot.at(var));
+
+		vector<bool> placed(iexp.num_goals(), false);
+		vector<bool> bound(var2slot.size(), false);
+		set<int> bound_heads;
+		for(int n=0; n<iexp.num_goals(); n++) {
+			int best=-1, best_bound=-1;
+			for(int gid=0; gid<iexp.num_goals(); gid++) {
+				if(placed[gid]) continue;
+				int num_bound=0;
+				for(const auto& symbol: iexp.goal_at(gid).symbols)
+					if(symbol.isconstant || bound[var2slot.at(symbol.var)])
+						num_bound++;
+				if(num_bound>best_bound) {
+					best = gid;  best_bound = num_bound;
+				}
+			}
+			placed[best] = true;
+			const auto& goal = iexp.goal_at(best);
+			auto it = query_br2goals.find(goal.br);
+			if(it==query_br2goals.end()) return false;
+			candidates.push_back(&(it->second));
+			num_head_slots_bound.push_back(bound_heads.size());
+			columns.push_back(vector<int>());
+			for(const auto& symbol: goal.symbols) {
+				if(symbol.isconstant) {
+					auto cit = const2sid.find(symbol.dt);
+					if(cit==const2sid.end()) return false;
+					columns.back().push_back(-1-cit->second);
+				}
+				else {
+					int slot = var2slot.at(symbol.var);
+					columns.back().push_back(slot);
+					bound[slot] = true;
+					if(projected_vars.find(symbol.var)!=projected_vars.end())
+						bound_heads.insert(slot);
+				}
+			}
+		}
+		return true;
+	}
 
-	list<ViewTuple> result;
-	Expression::Table vts(&index.expression(), br2table);
-	for(auto row: vts.df.get_unique_rows()) {
+	const std::set<std::vector<int>>& run() {
+		search(0, false);
+		return head_images;
+	}
+};
+
+/**serialization of the goals of exp, variable ids included. Indexes generated from the same 
+subexpression by dropping head variables or binding them share it*/
+string body_key(const Expression& exp) {
+	string key;
+	for(int gid=0; gid<exp.num_goals(); gid++) {
+		const auto& goal = exp.goal_at(gid);
+		key += to_string(goal.br->get_id())+"(";
+		for(const auto& symbol: goal.symbols)
+			key += (symbol.isconstant ? symbol.dt.show() : to_string(symbol.var)) + ",";
+		key += ")";
+	}
+	return key;
+}
+
+}
+
+void Query::add_view_tuples(list<ViewTuple>& result, const Index& index, 
+	const set<int>& projected_vars, const set<vector<int>>& images) const {
+	// positions of the head variables of index within projected_vars
+	vector<uint> positions;
+	uint pos=0;
+	for(auto var: projected_vars) {
+		if(index.expression().head_vars().find(var)!=index.expression().head_vars().end())
+			positions.push_back(pos);
+		pos++;
+	}
+	assert(positions.size()==index.expression().head_vars().size());
+
+	set<vector<int>> head_images;
+	for(const auto& image: images) {
+		vector<int> head_image;
+		for(auto p: positions)
+			head_image.push_back(image[p]);
+		head_images.insert(head_image);
+	}
+
+	// an image permuted by a head permutation of the index gives the same expansion with the index 
+	// variables renamed, so its time is the same in every plan. Only the first image of each is generated
+	set<vector<int>> permuted_images;
+	for(const auto& image: head_images) {
+		if(permuted_images.find(image)!=permuted_images.end())
+			continue;
 		map<int, Expression::Symbol> index2query;
-		for(auto headvar: index.expression().head_vars()) {
-			Data dt = row[vts.df.get_cid2pos(vts.headvar2cid.at(headvar))];
-			if(const2var.find(dt)==const2var.end())
-				index2query.emplace(headvar, Expression::Symbol(dt));
-			else
-				index2query.emplace(headvar, Expression::Symbol(const2var.at(dt)));
-		}
+		uint i=0;
+		for(auto headvar: index.expression().head_vars())
+			index2query.emplace(headvar, body.symbols.at(image[i++]));
 		result.push_back(ViewTuple(*this, index, index2query));
+
+		for(const auto& perm: index.head_permutations()) {
+			vector<int> permuted_image;
+			for(auto pos: perm)
+				permuted_image.push_back(image[pos]);
+			if(permuted_image!=image)
+				permuted_images.insert(permuted_image);
+		}
+	}
+}
+
+list<ViewTuple> Query::get_view_tuples(const Index& index) const {
+	list<ViewTuple> result;
+	ViewTupleMatcher matcher(body.goal_sids, body.br2goals);
+	const auto& head_vars = index.expression().head_vars();
+	if(matcher.prepare(index.expression(), body.const2sid, head_vars))
+		add_view_tuples(result, index, head_vars, matcher.run());
+	return result;
+}
+
+vector<list<ViewTuple>> Query::get_view_tuples(const vector<const Index*>& indexes, 
+	uint* num_bodies) const {
+	// group the indexes by body, collecting the head variables of all variants
+	map<string, pair<vector<uint>, set<int>>> body2indexes;
+	for(uint i=0; i<indexes.size(); i++) {
+		auto& group = body2indexes[body_key(indexes[i]->expression())];
+		group.first.push_back(i);
+		for(auto var: indexes[i]->expression().head_vars())
+			group.second.insert(var);
+	}
+	if(num_bodies!=nullptr)
+		*num_bodies = body2indexes.size();
+
+	vector<list<ViewTuple>> result(indexes.size());
+	for(const auto& body_group: body2indexes) {
+		const auto& group = body_group.second;
+		ViewTupleMatcher matcher(body.goal_sids, body.br2goals);
+		if(!matcher.prepare(indexes[group.first[0]]->expression(), body.const2sid, group.second))
+			continue;
+		const auto& images = matcher.run();
+		for(auto i: group.first)
+			add_view_tuples(result[i], *indexes[i], group.second, images);
 	}
 	return result;
 }
 
-Index::Index(const Expression& exp_arg): exp(exp_arg), E(exp),
+
+Index::Index(const Expression& exp_arg, const SampleEstimator* sampler): exp(exp_arg), E(exp, sampler),
 avg_disk_block_size(0), total_storage_cost(0) {
 	assert(!exp.empty());
 	
@@ -187,6 +485,26 @@ avg_disk_block_size(0), total_storage_cost(0) {
 	}
 	cout<<endl;
 	avg_disk_block_size/=num_blocks;
+
+	Query::Body body(exp);
+	vector<int> head_sids;
+	map<int, uint> sid2pos;
+	for(auto hv: exp.head_vars()) {
+		sid2pos[body.symbol_id(Expression::Symbol(hv))] = head_sids.size();
+		head_sids.push_back(body.symbol_id(Expression::Symbol(hv)));
+	}
+	set<vector<uint>> perms;
+	for(const auto& automorphism: body.isomorphisms(body, Query::max_automorphisms)) {
+		vector<uint> perm;
+		bool identity = true;
+		for(uint i=0; i<head_sids.size(); i++) {
+			perm.push_back(sid2pos.at(automorphism.symbol_perm[head_sids[i]]));
+			identity = identity && perm.back()==i;
+		}
+		if(!identity)
+			perms.insert(perm);
+	}
+	head_perms.assign(perms.begin(), perms.end());
 }
 
 // Index& Index::operator=(const Index& other) {
@@ -198,11 +516,16 @@ avg_disk_block_size(0), total_storage_cost(0) {
 
 double Index::storage_cost() const { return total_storage_cost;}
 double Index::avg_block_size() const {return avg_disk_block_size;}
+const CardinalityEstimator& Index::get_estimator() const {return E;}
 
 const Expression& Index::expression() const {
 	return exp;
 }
 
+const vector<vector<uint>>& Index::head_permutations() const {
+	return head_perms;
+}
+
 string Index::show(bool verbose) const {
 	string result = exp.show();
 	if(verbose) {
@@ -240,43 +563,205 @@ string ViewTuple::show(bool verbose) const {
 	}
 	result += "}, lb: " + to_string(cost_lb) + ", ub: " + to_string(cost_ub);
 	if(verbose)
-		result += ", exp: " + E.expression().show() + ", exp_bh: " + E_bh.expression().show();
+		result += ", exp: " + get_estimator().expression().show() + ", exp_bh: " + get_estimator_bh().expression().show();
 	return result;
 }
 
 
 
+namespace {
+
+/**Finds the subcore of a view tuple containing a given query goal: a set of query goals mapped onto 
+goals of the index such that query constants and head variables map to index constants or head 
+variables bound to them by the view tuple, and non-head query variables map consistently to index 
+variables. A query goal with a non-head variable mapped to a non-head index variable pulls every 
+other goal with that variable into the subcore. The search is iterative: each stack frame is a 
+query goal with the position of the next index goal to try, and undoing a choice restores the 
+mapping and the goals it added*/
+class SubcoreMatcher {
+	const Expression& qexp;
+	const Expression& iexp;
+	const std::map<int, Expression::Symbol>& index2query;
+	std::vector<std::vector<int>> candidates;  //!< index goals over the relation of each query goal
+	std::vector<bool> is_qheadvar, is_iheadvar;
+	std::vector<BitSet> var2goals;  //!< query goals containing each query variable
+
+	std::vector<int> mu;  //!< index variable each non-head query variable maps to, -1 if unmapped
+	std::vector<int> trail;  //!< query variables mapped so far, in order
+	struct Frame {
+		int q_gid;
+		uint next;  //!< position in candidates[q_gid] of the next index goal to try
+		uint trail_size;  //!< size of the trail before the current choice
+		BitSet new_goals;  //!< goals added to the unmapped goals by the current choice
+	};
+
+	// whether the query goal can be mapped on the index goal, extending mu and collecting new goals
+	bool try_goal(int q_gid, int i_gid, const BitSet& subcore, const BitSet& unmapped, BitSet& new_goals) {
+		const auto& q_symbols = qexp.goal_at(q_gid).symbols;
+		const auto& i_symbols = iexp.goal_at(i_gid).symbols;
+		for(uint i=0; i<q_symbols.size(); i++) {
+			const auto& q_symbol = q_symbols[i];
+			const auto& i_symbol = i_symbols[i];
+			if(q_symbol.isconstant || is_qheadvar[q_symbol.var]) {
+				if(q_symbol.isconstant && i_symbol==q_symbol)
+					continue;
+				if(i_symbol.isconstant)
+					return false;
+				auto it = index2query.find(i_symbol.var);
+				if(it==index2query.end() || it->second!=q_symbol)
+					return false;
+			}
+			else {
+				if(i_symbol.isconstant)
+					return false;
+				if(mu[q_symbol.var]<0) {
+					mu[q_symbol.var] = i_symbol.var;
+					trail.push_back(q_symbol.var);
+				}
+				else if(mu[q_symbol.var]!=i_symbol.var)
+					return false;
+				if(!is_iheadvar[i_symbol.var]) {
+					BitSet goals = var2goals[q_symbol.var];
+					goals -= subcore;
+					goals -= unmapped;
+					new_goals |= goals;
+				}
+			}
+		}
+		return true;
+	}
+
+	void undo(Frame& frame, BitSet& unmapped) {
+		for(uint i=frame.trail_size; i<trail.size(); i++)
+			mu[trail[i]] = -1;
+		trail.resize(frame.trail_size);
+		unmapped -= frame.new_goals;
+		frame.new_goals.clear();
+	}
+public:
+	SubcoreMatcher(const ViewTuple& vt) : qexp(vt.query.expression()), iexp(vt.index.expression()), 
+		index2query(vt.index2query) {
+		map<const BaseRelation*, vector<int>> br2igoals;
+		for(int i_gid=0; i_gid<iexp.num_goals(); i_gid++)
+			br2igoals[iexp.goal_at(i_gid).br].push_back(i_gid);
+		for(int q_gid=0; q_gid<qexp.num_goals(); q_gid++) {
+			auto it = br2igoals.find(qexp.goal_at(q_gid).br);
+			candidates.push_back(it==br2igoals.end() ? vector<int>() : it->second);
+		}
+
+		int num_qvars = qexp.vars().empty() ? 0 : *qexp.vars().rbegin()+1;
+		is_qheadvar.assign(num_qvars, false);
+		for(auto var: qexp.head_vars())
+			is_qheadvar[var] = true;
+		var2goals.resize(num_qvars);
+		for(auto var: qexp.vars())
+			for(auto gid: qexp.goals_containing(var))
+				var2goals[var].insert(gid);
+		mu.assign(num_qvars, -1);
+
+		int num_ivars = iexp.vars().empty() ? 0 : *iexp.vars().rbegin()+1;
+		is_iheadvar.assign(num_ivars, false);
+		for(auto var: iexp.head_vars())
+			is_iheadvar[var] = true;
+	}
+
+	/**returns whether a subcore containing q_gid exists and stores it in subcore. The first choice 
+	of index goals in goal order that works is taken*/
+	bool match(int q_gid, BitSet& subcore) {
+		BitSet unmapped{(uint) q_gid};
+		vector<Frame> stack;
+		auto push = [&]() {
+			int gid = *unmapped.begin();
+			unmapped.erase(gid);
+			subcore.insert(gid);
+			stack.push_back(Frame{gid, 0, (uint) trail.size(), BitSet()});
+		};
+		push();
+		while(!stack.empty()) {
+			Frame& top = stack.back();
+			undo(top, unmapped);
+			const auto& cands = candidates[top.q_gid];
+			bool found = false;
+			while(top.next<cands.size() && !found) {
+				found = try_goal(top.q_gid, cands[top.next++], subcore, unmapped, top.new_goals);
+				if(!found) 
+					undo(top, unmapped);
+			}
+			if(!found) {
+				subcore.erase(top.q_gid);
+				unmapped.insert(top.q_gid);
+				stack.pop_back();
+				continue;
+			}
+			unmapped |= top.new_goals;
+			if(unmapped.empty()) {
+				// leave mu clean for the next call
+				for(auto var: trail)
+					mu[var] = -1;
+				trail.clear();
+				return true;
+			}
+			push();
+		}
+		subcore.clear();
+		return false;
+	}
+};
+
+}
+
 ViewTuple::ViewTuple(const Query& query_arg, const Index& index_arg,
 		map<int, Expression::Symbol> index2query_arg) 
-: query(query_arg), index(index_arg), index2query(index2query_arg), first_sc_goal_ind(query.goal_order().size()),
-E(index.expression(), set<int>()), E_bh(index.expression(), set<int>()) {
-	set<int> unexplored_goals;
-	for(int gid=0; gid<query.expression().num_goals(); gid++)
-		unexplored_goals.insert(gid);
+: query(query_arg), index(index_arg), index2query(index2query_arg), first_sc_goal_ind(query.goal_order().size()) {
+	SubcoreMatcher matcher(*this);
+	BitSet explored_goals;
 	for(int gid=0; gid<query.expression().num_goals(); gid++) {
-		if(unexplored_goals.find(gid)!=unexplored_goals.end()) {
-			set<int> subcore;
-			set<int> unmapped_goals;
-			unmapped_goals.insert(gid);
-			map<int, int> mu;
-			bool match=false;
-			try_match(match, subcore, unmapped_goals, mu);
-			if(match) 
+		if(!explored_goals.contains(gid)) {
+			BitSet subcore;
+			if(matcher.match(gid, subcore)) {
 				subcores.insert(subcore);
-			for(auto id: subcore)
-				unexplored_goals.erase(id);
+				explored_goals |= subcore;
+			}
 		}
 	}
 
-	for(auto subcore: subcores) {
-		if(subcore.size()==1)
-			sc_goals.insert(*subcore.begin());
+	compute_coverage();
+}
+
+ViewTuple::ViewTuple(const ViewTuple& other, const Query& query_arg, const Query::Isomorphism& iso)
+: query(query_arg), index(other.index), cost_lb(other.cost_lb), cost_ub(other.cost_ub), 
+first_sc_goal_ind(query.goal_order().size()) {
+	for(const auto& kv: other.index2query)
+		index2query.emplace(kv.first, query.symbol_at(iso.symbol_perm[other.query.symbol_id(kv.second)]));
+	for(const auto& subcore: other.subcores) {
+		BitSet mapped;
 		for(auto gid: subcore)
-			wc_goals.insert(gid);
+			mapped.insert(iso.goal_perm[gid]);
+		subcores.insert(mapped);
+	}
+	compute_coverage();
+}
+
+void ViewTuple::compute_coverage() {
+	for(const auto& subcore: subcores) {
+		if(subcore.size()==1)
+			sc_goals |= subcore;
+		wc_goals |= subcore;
 	}
+	for(uint i=0; i<query.goal_order().size(); i++)
+		if(sc_goals.contains(query.goal_order()[i])) {
+			first_sc_goal_ind = i;
+			break;
+		}
+}
 
-	Expression expansion = index.expression();
-	for(auto const& kv: index2query) {
+namespace {
+
+Expression expand(const ViewTuple& vt, bool bh, map<int, int>& qvar2evar) {
+	Expression expansion = vt.index.expression();
+	for(auto const& kv: vt.index2query) {
+		if(bh && !vt.index.expression().is_bound_headvar(kv.first))
+			continue;
 		if(kv.second.isconstant)
 			expansion.select(kv.first, kv.second.dt);
 		else
@@ -285,104 +770,28 @@ E(index.expression(), set<int>()), E_bh(index.expression(), set<int>()) {
 			else
 				qvar2evar[kv.second.var] = expansion.join(kv.first, qvar2evar[kv.second.var]);
 	}
-	E = CardinalityEstimator(expansion);
+	return expansion;
+}
 
-	Expression expansion_bh = index.expression();
-	for(auto const& kv: index2query) {
-		if(index.expression().is_bound_headvar(kv.first)) {
-			if(kv.second.isconstant)
-				expansion_bh.select(kv.first, kv.second.dt);
-			else
-				if(qvar2evar_bh.find(kv.second.var)==qvar2evar_bh.end())
-					qvar2evar_bh[kv.second.var] = kv.first;
-				else
-					qvar2evar_bh[kv.second.var] = expansion_bh.join(kv.first, qvar2evar_bh[kv.second.var]);
-		}
-	}
-	E_bh = CardinalityEstimator(expansion_bh);
+}
 
-	for(uint i=0; i<query.goal_order().size(); i++)
-		if(sc_goals.find(query.goal_order()[i])!=sc_goals.end()) {
-			first_sc_goal_ind = i;
-			break;
-		}
+ViewTuple::Expansion::Expansion(const ViewTuple& vt, bool bh) : 
+E(expand(vt, bh, qvar2evar), vt.index.get_estimator().sample_estimator()) {}
+
+const ViewTuple::Expansion& ViewTuple::expansion(bool bh) const {
+	auto& cached = (bh ? exp_bh : exp_all);
+	if(!cached)
+		cached = std::make_shared<const Expansion>(*this, bh);
+	return *cached;
 }
 
-const set<uint>& ViewTuple::covered_goals(bool oe) const {
+const BitSet& ViewTuple::covered_goals(bool oe) const {
 	if(oe) return sc_goals;
 	else return wc_goals;
 }
 
-void ViewTuple::try_match(bool& match, set<int>& subcore,
-	set<int>& unmapped_goals, map<int, int>& mu) {
-	if(unmapped_goals.empty()) {
-		match = true;
-		return;
-	}
-	int q_gid = *(unmapped_goals.begin());
-	unmapped_goals.erase(q_gid);
-	subcore.insert(q_gid);
-	for(int i_gid=0; i_gid<index.expression().num_goals(); i_gid++) {
-		if(query.expression().goal_at(q_gid).br
-			==index.expression().goal_at(i_gid).br) {
-			set<int> newkeys;
-			set<int> newgoals;
-			const auto& q_symbols = query.expression().goal_at(q_gid).symbols;
-			const auto& i_symbols = index.expression().goal_at(i_gid).symbols;
-			bool flag=true;
-			for(uint i=0; i<q_symbols.size(); i++) {
-				if(q_symbols.at(i).isconstant) {
-					if(i_symbols.at(i)!=q_symbols.at(i) &&
-						(index2query.find(i_symbols.at(i).var)==index2query.end() ? 
-							true: index2query.at(i_symbols.at(i).var)!=q_symbols.at(i))) {
-						flag = false;
-						break;
-					}
-				}
-				else {
-					if(query.expression().head_vars().find(q_symbols.at(i).var) 
-						!= query.expression().head_vars().end())  {
-						if(index2query.find(i_symbols.at(i).var)!=index2query.end() ?
-							index2query.at(i_symbols.at(i).var)!=q_symbols.at(i) : true) {
-								flag = false;
-								break;
-						}
-					}
-					else {
-						if(mu.find(q_symbols.at(i).var)==mu.end()) {
-							newkeys.insert(q_symbols.at(i).var);
-							mu[q_symbols.at(i).var] = i_symbols.at(i).var;
-						}
-						if(mu.at(q_symbols.at(i).var)!=i_symbols.at(i).var) {
-							flag=false;
-							break;
-						}
-						if(index.expression().head_vars().find(i_symbols.at(i).var) 
-							== index.expression().head_vars().end())
-							for(int new_q_gid: query.expression().goals_containing(q_symbols.at(i).var))
-								if(subcore.find(new_q_gid)==subcore.end() 
-									&& unmapped_goals.find(new_q_gid)==unmapped_goals.end())
-									newgoals.insert(new_q_gid);
-					}
-				}
-			}
-			if(flag) {
-				for(int goal: newgoals)
-					unmapped_goals.insert(goal);
-				try_match(match, subcore, unmapped_goals, mu);
-				if(match) return;
-				for(int goal: newgoals)
-					unmapped_goals.erase(goal);
-			}
-			for(int key: newkeys)
-				mu.erase(key);
-		}
-	}
-}
-
-
-Plan::Plan(const Query& qry): query(qry), 
-E(query.expression(), set<int>()) {
+Plan::Plan(const Query& qry, const SampleEstimator* sampler): query(qry), 
+E(query.expression(), set<int>(), sampler) {
 	complete = false;
 }
 
@@ -390,16 +799,11 @@ E(query.expression(), set<int>()) {
 bool Plan::append(const ViewTuple& vt) {
 	cost += time(vt);
 
-	for(auto gid: vt.sc_goals)
-		sc_goals.insert(gid);
-
-	for(auto gid: vt.wc_goals)
-		wc_goals.insert(gid);	
+	sc_goals |= vt.sc_goals;
+	wc_goals |= vt.wc_goals;
 
 	auto& Egoals = E.considered_goals();
-	vector<set<int>> subcores;
-	for(auto subcore: vt.subcores) {
-		subcores.push_back(subcore);
+	for(const auto& subcore: vt.subcores) {
 		bool add_subcore = true;
 		for(auto gid: subcore)
 			if(Egoals.find(gid)!=Egoals.end()) 
@@ -422,27 +826,54 @@ bool Plan::append(const ViewTuple& vt) {
 		for(int i=0; i<query.expression().num_goals(); i++)
 			E.add_goal(i);
 	}
+	// the expansion of a stage is read by every later call to time, so it is built here once
+	vt.get_estimator();
 	stages.push_back(&vt);
 	set_stages.insert(&vt);
 
 	return true;
 }
 
+vector<set<int>> Plan::stage_pre_select_vars() const {
+	vector<set<int>> stage_selections;
+	for(auto vt: stages) {
+		stage_selections.emplace_back();
+		for(auto const& kv: vt->get_qvar2evar()) 
+			if(query.expression().is_bound_headvar(kv.first)) 
+				stage_selections.back().insert(kv.second);
+	}
+	return stage_selections;
+}
+
 double Plan::time(const ViewTuple& nvt) const {
+	return time(nvt, stage_pre_select_vars());
+}
+
+vector<double> Plan::time(const vector<const ViewTuple*>& vts) const {
+	auto stage_selections = stage_pre_select_vars();
+	vector<double> costs;
+	costs.reserve(vts.size());
+	for(auto vt: vts)
+		costs.push_back(time(*vt, stage_selections));
+	return costs;
+}
+
+double Plan::time(const ViewTuple& nvt, const vector<set<int>>& stage_selections) const {
 	double num_lookups=1;
+	const auto& nvt_qvar2evar_bh = nvt.get_qvar2evar_bh();
 	vector<int> qvars;
-	for(auto const& kv: nvt.qvar2evar_bh) 
+	for(auto const& kv: nvt_qvar2evar_bh) 
 		if(!query.expression().is_bound_headvar(kv.first)) qvars.push_back(kv.first);
 	
 	vector<int> vars;
-	for(auto qvar: qvars) vars.push_back(nvt.qvar2evar_bh.at(qvar));
+	for(auto qvar: qvars) vars.push_back(nvt_qvar2evar_bh.at(qvar));
 	set<int> pre_select_vars;
-	for(auto const& kv: nvt.qvar2evar_bh) 
+	for(auto const& kv: nvt_qvar2evar_bh) 
 		if(query.expression().is_bound_headvar(kv.first)) 
 			pre_select_vars.insert(kv.second);
 	
 	map<int, double> qvar2card;
-	auto cards = nvt.E_bh.get_cardinalities(vars, pre_select_vars);
+	auto cards = nvt.get_estimator_bh().get_cardinalities(vars, pre_select_vars);
 	for(uint i=0; i<qvars.size(); i++)
 		qvar2card[qvars[i]] = cards[i];
 
@@ -450,24 +881,21 @@ double Plan::time(const ViewTuple& nvt) const {
 	pre_select_vars.clear();
 	for(auto qvar: qvars) 
 		if(E.is_present(qvar)) vars.push_back(qvar);
-	pre_select_vars = query.expression().bound_headvars();
-	cards = E.get_cardinalities(vars, pre_select_vars);
+	cards = E.get_cardinalities(vars, query.expression().bound_headvars());
 	for(uint i=0; i<vars.size(); i++)
 		qvar2card[vars[i]] = min(cards[i], qvar2card[vars[i]]);
 	
-	for(auto vt: stages) {
+	for(uint s=0; s<stages.size(); s++) {
+		auto vt = stages[s];
+		const auto& qvar2evar = vt->get_qvar2evar();
 		vars.clear();
-		pre_select_vars.clear();
 		vector<int> vars_q;
 		for(auto qvar: qvars) 
-			if(vt->qvar2evar.find(qvar)!=vt->qvar2evar.end()) {
-				vars.push_back(vt->qvar2evar.at(qvar));
+			if(qvar2evar.find(qvar)!=qvar2evar.end()) {
+				vars.push_back(qvar2evar.at(qvar));
 				vars_q.push_back(qvar);
 			}
-		for(auto const& kv: vt->qvar2evar) 
-			if(query.expression().is_bound_headvar(kv.first)) 
-				pre_select_vars.insert(kv.second);
-		cards = vt->E.get_cardinalities(vars, pre_select_vars);
+		cards = vt->get_estimator().get_cardinalities(vars, stage_selections[s]);
 		for(uint i=0; i<vars.size(); i++)
 			qvar2card[vars_q[i]] = min(cards[i], qvar2card[vars_q[i]]);
 	}
@@ -483,26 +911,18 @@ double Plan::time(const ViewTuple* vt) const {return time(*vt);}
 
 double Plan::current_cost() const {return cost;}
 
-bool Plan::check_completeness(set<int>& covered_goals,
-	vector<set<int>>& subcores, uint pos) const {
+bool Plan::check_completeness(BitSet& covered_goals,
+	const vector<BitSet>& subcores, uint pos) const {
 	if(((int)covered_goals.size())==query.expression().num_goals())
 		return true;
 	if(pos>=subcores.size())
 		return false;
 	auto& subcore=subcores.at(pos);
-	bool try_adding=true;
-	for(auto gid: subcore)
-		if(covered_goals.find(gid)!=covered_goals.end()) {
-			try_adding=false;
-			break;
-		}
-	if(try_adding) {
-		for(auto gid: subcore)
-			covered_goals.insert(gid);
+	if(!covered_goals.intersects(subcore)) {
+		covered_goals |= subcore;
 		if(check_completeness(covered_goals, subcores, pos+1)) 
 			return true;
-		for(auto gid: subcore)
-			covered_goals.erase(gid);
+		covered_goals -= subcore;
 	}
 	return check_completeness(covered_goals, subcores, pos+1);
 }
@@ -511,36 +931,28 @@ bool Plan::iscomplete() const {
 	if(complete) return complete;
 	if(((int)wc_goals.size())<query.expression().num_goals()) 
 		return false;
-	vector<set<int>> all_subcores;
+	vector<BitSet> all_subcores;
 	for(auto vt: stages)
 		for(auto& subcore: vt->subcores)
 			all_subcores.push_back(subcore);
-	set<int> covered_goals;
+	BitSet covered_goals;
 	bool result = check_completeness(covered_goals, all_subcores, 0);
 	
 	return result;
 }
 
-const set<uint>& Plan::strongly_covered_goals() const {return sc_goals;}
-const set<uint>& Plan::weakly_covered_goals() const {return wc_goals;}
-const set<uint>& Plan::covered_goals(bool oe) const {
+const BitSet& Plan::strongly_covered_goals() const {return sc_goals;}
+const BitSet& Plan::weakly_covered_goals() const {return wc_goals;}
+const BitSet& Plan::covered_goals(bool oe) const {
 	if(oe) return sc_goals;
 	else return wc_goals;
 }
 
 int Plan::extra_sc_goals(const ViewTuple& vt) const {
-	int result=0;
-	for(auto gid: vt.sc_goals)
-		if(sc_goals.find(gid)==sc_goals.end())
-			result += 1;
-	return result;
+	return vt.sc_goals.size() - vt.sc_goals.intersection_size(sc_goals);
 } 
 int Plan::extra_wc_goals(const ViewTuple& vt) const {
-	int result=0;
-	for(auto gid: vt.wc_goals)
-		if(wc_goals.find(gid)==wc_goals.end())
-			result += 1;
-	return result;
+	return vt.wc_goals.size() - vt.wc_goals.intersection_size(wc_goals);
 }
 
 string Plan::show() const {
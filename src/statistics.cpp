@@ -0,0 +1,231 @@
+#include "statistics.h"
+#include "data.h"
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cassert>
+
+using std::vector;
+using std::map;
+using std::set;
+using std::string;
+using std::pair;
+using std::make_pair;
+using std::to_string;
+using std::min;
+using std::max;
+
+
+uint64_t hash_data(const Data& dt) {
+	uint64_t hash = (dt.get_dtype()==Dtype::Int ?
+		std::hash<int>()(dt.get_int_val()) : std::hash<string>()(dt.get_str_val())^0x9e3779b97f4a7c15ULL);
+	// splitmix64 finalizer, std::hash of ints is the identity
+	hash = (hash^(hash>>30))*0xbf58476d1ce4e5b9ULL;
+	hash = (hash^(hash>>27))*0x94d049bb133111ebULL;
+	return hash^(hash>>31);
+}
+
+uint64_t hash_combine(uint64_t hash1, uint64_t hash2) {
+	uint64_t hash = hash1*0x9e3779b97f4a7c15ULL + hash2;
+	hash = (hash^(hash>>30))*0xbf58476d1ce4e5b9ULL;
+	hash = (hash^(hash>>27))*0x94d049bb133111ebULL;
+	return hash^(hash>>31);
+}
+
+
+// functions of class HyperLogLog
+HyperLogLog::HyperLogLog(uint precision_arg): precision(precision_arg),
+registers(uint64_t(1)<<precision_arg, 0) {
+	assert(precision>=4 && precision<=18);
+}
+
+void HyperLogLog::add(uint64_t hash) {
+	uint64_t reg = hash>>(64-precision);
+	uint64_t rest = hash<<precision;
+	uint8_t rank = (rest==0 ? 64-precision+1 : __builtin_clzll(rest)+1);
+	registers[reg] = max(registers[reg], rank);
+}
+
+void HyperLogLog::merge(const HyperLogLog& other) {
+	assert(precision==other.precision);
+	for(uint i=0; i<registers.size(); i++)
+		registers[i] = max(registers[i], other.registers[i]);
+}
+
+double HyperLogLog::estimate() const {
+	double m = registers.size();
+	double sum = 0;
+	uint num_zeros = 0;
+	for(auto reg: registers) {
+		sum += std::ldexp(1.0, -reg);
+		if(reg==0) num_zeros++;
+	}
+	double alpha = 0.7213/(1+1.079/m);
+	double estimate = alpha*m*m/sum;
+	// linear counting is more accurate while many registers are still empty
+	if(estimate<=2.5*m && num_zeros>0)
+		estimate = m*std::log(m/num_zeros);
+	return estimate;
+}
+
+
+// functions of struct ColumnStatistics
+double ColumnStatistics::value_count(const Data& dt) const {
+	for(auto& mcv: most_common)
+		if(mcv.first==dt)
+			return mcv.second;
+	if(!histogram.empty()) {
+		auto it = std::lower_bound(histogram.begin(), histogram.end(), dt,
+			[](const Bucket& bucket, const Data& val) {return bucket.upper<val;});
+		if(it==histogram.end()) it--;
+		return it->num_values/it->num_distinct;
+	}
+	double rest_values = num_values, rest_distinct = num_distinct-most_common.size();
+	for(auto& mcv: most_common)
+		rest_values -= mcv.second;
+	return (rest_distinct<1 ? 0 : max(0.0, rest_values)/rest_distinct);
+}
+
+string ColumnStatistics::show() const {
+	string result = "{values: "+to_string(int(num_values))+", distinct: "+to_string(int(num_distinct));
+	result += ", most common: ";
+	for(uint i=0; i<most_common.size() && i<3; i++)
+		result += most_common[i].first.show()+" ("+to_string(int(most_common[i].second))+") ";
+	return result+"..., buckets: "+to_string(histogram.size())+"}";
+}
+
+
+// functions of class StatisticsCollector
+StatisticsCollector::StatisticsCollector(uint num_cols, bool joint_arg, uint num_mcvs_arg, 
+	uint num_buckets_arg, uint sample_size_arg): num_mcvs(num_mcvs_arg), num_buckets(num_buckets_arg),
+sample_size(sample_size_arg), columns(num_cols), joint(joint_arg) {
+	if(joint)
+		for(uint col1=0; col1<num_cols; col1++)
+			for(uint col2=col1+1; col2<num_cols; col2++)
+				pair_hlls.emplace(make_pair(col1, col2), HyperLogLog());
+}
+
+void StatisticsCollector::add_tuple(const vector<Data>& tuple) {
+	assert(tuple.size()==columns.size());
+	num_tuples++;
+	vector<uint64_t> hashes;
+	for(auto& dt: tuple)
+		hashes.push_back(hash_data(dt));
+	if(joint) {
+		uint64_t tuple_hash = 0;
+		for(auto hash: hashes)
+			tuple_hash = hash_combine(tuple_hash, hash);
+		tuples_hll.add(tuple_hash);
+		for(auto& kv: pair_hlls)
+			kv.second.add(hash_combine(hashes[kv.first.first], hashes[kv.first.second]));
+	}
+
+	// a single reservoir position is drawn for the whole tuple, so the samples of the columns are rows of one sample
+	uint64_t pos = (num_tuples<=sample_size ? num_tuples-1 :
+		std::uniform_int_distribution<uint64_t>(0, num_tuples-1)(generator));
+	for(uint col=0; col<columns.size(); col++) {
+		auto& state = columns[col];
+		const Data& dt = tuple[col];
+		state.hll.add(hashes[col]);
+
+		// Space-Saving keeps every value more frequent than num_tuples/capacity. The least counted 
+		// value is replaced on a miss, found in by_count in logarithmic time
+		auto it = state.counters.find(dt);
+		if(it!=state.counters.end()) {
+			state.by_count.erase(make_pair(it->second.first, dt));
+			it->second.first++;
+			state.by_count.insert(make_pair(it->second.first, dt));
+		}
+		else if(state.counters.size()<8*num_mcvs) {
+			state.counters.emplace(dt, make_pair(1.0, 0.0));
+			state.by_count.insert(make_pair(1.0, dt));
+		}
+		else {
+			auto min_it = state.by_count.begin();
+			double min_count = min_it->first;
+			state.counters.erase(min_it->second);
+			state.by_count.erase(min_it);
+			state.counters.emplace(dt, make_pair(min_count+1, min_count));
+			state.by_count.insert(make_pair(min_count+1, dt));
+		}
+
+		if(pos<sample_size) {
+			if(state.sample.size()<sample_size)
+				state.sample.push_back(dt);
+			else
+				state.sample[pos] = dt;
+		}
+	}
+}
+
+vector<ColumnStatistics> StatisticsCollector::statistics() const {
+	vector<ColumnStatistics> result;
+	for(auto& state: columns) {
+		result.emplace_back();
+		auto& stats = result.back();
+		stats.num_values = num_tuples;
+		stats.num_distinct = min(num_tuples, std::round(state.hll.estimate()));
+
+		// only values whose count is certain to be above the average are kept as most common values
+		vector<pair<double, Data>> by_count;
+		for(auto& kv: state.counters)
+			if(kv.second.first-kv.second.second > num_tuples/max(1.0, stats.num_distinct))
+				by_count.push_back(make_pair(kv.second.first, kv.first));
+		std::sort(by_count.begin(), by_count.end(), [](const pair<double, Data>& a, const pair<double, Data>& b) {
+			return a.first>b.first || (a.first==b.first && a.second<b.second);});
+		set<Data> mcvs;
+		double mcv_values = 0;
+		for(uint i=0; i<by_count.size() && i<num_mcvs; i++) {
+			stats.most_common.push_back(make_pair(by_count[i].second, by_count[i].first));
+			mcvs.insert(by_count[i].second);
+			mcv_values += by_count[i].first;
+		}
+
+		// the histogram covers the values that are not among the most common ones
+		vector<Data> sample;
+		for(auto& dt: state.sample)
+			if(mcvs.find(dt)==mcvs.end())
+				sample.push_back(dt);
+		if(sample.empty())
+			continue;
+		std::sort(sample.begin(), sample.end());
+		uint sample_distinct = 1;
+		for(uint i=1; i<sample.size(); i++)
+			if(sample[i-1]!=sample[i]) sample_distinct++;
+		double rest_values = max(0.0, num_tuples-mcv_values);
+		double rest_distinct = max(1.0, stats.num_distinct-mcvs.size());
+		uint depth = std::ceil(double(sample.size())/num_buckets);
+		for(uint begin=0, end; begin<sample.size(); begin=end) {
+			// a value never spans two buckets
+			end = min<uint>(begin+depth, sample.size());
+			while(end<sample.size() && sample[end]==sample[end-1])
+				end++;
+			uint bucket_distinct = 1;
+			for(uint i=begin+1; i<end; i++)
+				if(sample[i-1]!=sample[i]) bucket_distinct++;
+			double num_values = rest_values*(end-begin)/sample.size();
+			double num_distinct = rest_distinct*bucket_distinct/sample_distinct;
+			stats.histogram.push_back(ColumnStatistics::Bucket{sample[end-1], num_values,
+				max(1.0, min(num_values, num_distinct))});
+		}
+	}
+	return result;
+}
+
+double StatisticsCollector::num_distinct_tuples() const {
+	if(!joint) return 0;
+	return min(num_tuples, std::round(tuples_hll.estimate()));
+}
+
+map<pair<uint, uint>, double> StatisticsCollector::num_distinct_pairs() const {
+	map<pair<uint, uint>, double> result;
+	for(auto& kv: pair_hlls)
+		result[kv.first] = min(num_tuples, std::round(kv.second.estimate()));
+	return result;
+}
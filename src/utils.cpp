@@ -161,6 +161,135 @@ void esutils::set_difference_inplace(set<uint>& s1, const set<uint>& s2) {
 		s1.erase(ele);
 }
 
+esutils::BitSet::const_iterator::const_iterator(const BitSet* bs_arg, uint wid_arg)
+: bs(bs_arg), wid(wid_arg), rest(bs_arg->word(wid_arg)) {
+	skip_empty();
+}
+
+void esutils::BitSet::const_iterator::skip_empty() {
+	while(rest==0 && wid<bs->num_words())
+		rest = bs->word(++wid);
+}
+
+esutils::BitSet::BitSet(std::initializer_list<uint> eles): low(0) {
+	for(auto ele: eles)
+		insert(ele);
+}
+
+void esutils::BitSet::trim() {
+	while(!high.empty() && high.back()==0)
+		high.pop_back();
+}
+
+bool esutils::BitSet::any_above(uint ele) const {
+	uint wid = ele/max_mask_size, bit = ele%max_mask_size;
+	if(bit+1<max_mask_size && (word(wid)>>(bit+1))!=0)
+		return true;
+	return wid+1<num_words();
+}
+
+void esutils::BitSet::insert(uint ele) {
+	uint wid = ele/max_mask_size;
+	if(wid==0) {
+		low |= uint64_t(1)<<ele;
+		return;
+	}
+	if(high.size()<wid)
+		high.resize(wid, 0);
+	high[wid-1] |= uint64_t(1)<<(ele%max_mask_size);
+}
+
+void esutils::BitSet::erase(uint ele) {
+	uint wid = ele/max_mask_size;
+	if(wid==0)
+		low &= ~(uint64_t(1)<<ele);
+	else if(wid<=high.size()) {
+		high[wid-1] &= ~(uint64_t(1)<<(ele%max_mask_size));
+		trim();
+	}
+}
+
+bool esutils::BitSet::contains(uint ele) const {
+	return (word(ele/max_mask_size)>>(ele%max_mask_size)) & 1;
+}
+
+uint esutils::BitSet::size() const {
+	uint result = __builtin_popcountll(low);
+	for(auto w: high)
+		result += __builtin_popcountll(w);
+	return result;
+}
+
+uint esutils::BitSet::intersection_size(const BitSet& other) const {
+	uint result = __builtin_popcountll(low & other.low);
+	for(uint i=0; i<high.size() && i<other.high.size(); i++)
+		result += __builtin_popcountll(high[i] & other.high[i]);
+	return result;
+}
+
+bool esutils::BitSet::intersects(const BitSet& other) const {
+	if(low & other.low)
+		return true;
+	for(uint i=0; i<high.size() && i<other.high.size(); i++)
+		if(high[i] & other.high[i])
+			return true;
+	return false;
+}
+
+esutils::BitSet& esutils::BitSet::operator|=(const BitSet& other) {
+	low |= other.low;
+	if(high.size()<other.high.size())
+		high.resize(other.high.size(), 0);
+	for(uint i=0; i<other.high.size(); i++)
+		high[i] |= other.high[i];
+	return *this;
+}
+
+esutils::BitSet& esutils::BitSet::operator&=(const BitSet& other) {
+	low &= other.low;
+	if(high.size()>other.high.size())
+		high.resize(other.high.size());
+	for(uint i=0; i<high.size(); i++)
+		high[i] &= other.high[i];
+	trim();
+	return *this;
+}
+
+esutils::BitSet& esutils::BitSet::operator-=(const BitSet& other) {
+	low &= ~other.low;
+	for(uint i=0; i<high.size() && i<other.high.size(); i++)
+		high[i] &= ~other.high[i];
+	trim();
+	return *this;
+}
+
+/**Both sets agree on the elements below the smallest element d in only one of them. The set 
+holding d is smaller iff the other one continues past d, otherwise the other one is its prefix*/
+bool esutils::BitSet::operator<(const BitSet& other) const {
+	for(uint i=0; i<num_words() || i<other.num_words(); i++) {
+		uint64_t diff = word(i) ^ other.word(i);
+		if(diff==0) continue;
+		uint d = i*max_mask_size+__builtin_ctzll(diff);
+		if(contains(d))
+			return other.any_above(d);
+		return !any_above(d);
+	}
+	return false;
+}
+
+uint esutils::set_intersection_size(const BitSet& s1, const BitSet& s2) {
+	return s1.intersection_size(s2);
+}
+
+void esutils::set_difference_inplace(BitSet& s1, const BitSet& s2) {
+	s1 -= s2;
+}
+
+esutils::BitSet esutils::set_difference(const BitSet& s1, const BitSet& s2) {
+	BitSet result = s1;
+	result -= s2;
+	return result;
+}
 
 vector<set<int>> esutils::generate_subsets(uint n, uint k) {
 	assert(k<=n);
@@ -177,6 +306,79 @@ vector<set<int>> esutils::generate_subsets(uint n, uint k) {
 	return result;
 }
 
+uint64_t esutils::set_to_mask(const set<int>& s) {
+	uint64_t mask=0;
+	for(auto ele: s) {
+		assert(ele>=0 && ele<(int) max_mask_size);
+		mask |= (uint64_t(1)<<ele);
+	}
+	return mask;
+}
+
+set<int> esutils::mask_to_set(uint64_t mask) {
+	set<int> result;
+	for(; mask!=0; mask &= mask-1)
+		result.insert(__builtin_ctzll(mask));
+	return result;
+}
+
+/**Enumerates masks with k bits set in increasing order (Gosper's hack) and reverses them, 
+which is the order in which generate_subsets returns the subsets*/
+vector<uint64_t> esutils::generate_subset_masks(uint n, uint k) {
+	assert(k<=n && n<=max_mask_size);
+	if(k==0)
+		return vector<uint64_t>{0};
+	vector<uint64_t> result;
+	uint64_t mask = (k==64 ? ~uint64_t(0) : (uint64_t(1)<<k)-1);
+	uint64_t last = mask<<(n-k);
+	while(true) {
+		result.push_back(mask);
+		if(mask==last) break;
+		uint64_t lowest = mask & (~mask+1);
+		uint64_t ripple = mask+lowest;
+		mask = ripple | (((mask^ripple)>>2)/lowest);
+	}
+	std::reverse(result.begin(), result.end());
+	return result;
+}
+
+esutils::ConnectedSubsets::ConnectedSubsets(const vector<uint64_t>& adjacency_arg, uint max_size_arg)
+: adjacency(adjacency_arg), max_size(max_size_arg), root(0) {
+	assert(adjacency.size()<=max_mask_size);
+}
+
+/**Subsets rooted at vertex v only contain vertices larger than v. A frame is extended by one vertex 
+w of its extension at a time; the child's extension additionally gets the neighbours of w that are 
+not already adjacent to the subset, which guarantees that every subset is produced once.*/
+bool esutils::ConnectedSubsets::next(uint64_t& subset) {
+	while(!stack.empty()) {
+		Frame& top = stack.back();
+		if(top.extension==0 || (uint) __builtin_popcountll(top.subset)>=max_size) {
+			stack.pop_back();
+			continue;
+		}
+		uint64_t w = top.extension & (~top.extension+1);
+		top.extension &= ~w;
+		uint64_t root_bit = top.subset & (~top.subset+1);
+		uint64_t above_root = ~((root_bit<<1)-1);
+		uint64_t nbrs = adjacency[__builtin_ctzll(w)];
+		Frame child {top.subset | w, top.extension | (nbrs & ~top.closed_nbrs & above_root),
+			top.closed_nbrs | nbrs | w};
+		stack.push_back(child);
+		subset = child.subset;
+		return true;
+	}
+	if(root>=adjacency.size() || max_size==0)
+		return false;
+	uint64_t v = uint64_t(1)<<root;
+	uint64_t above_root = ~((uint64_t(2)<<root)-1);
+	Frame frame {v, adjacency[root] & above_root, adjacency[root] | v};
+	stack.push_back(frame);
+	root++;
+	subset = v;
+	return true;
+}
+
 esutils::ExtremeFraction::ExtremeFraction(){}
 
 esutils::ExtremeFraction::ExtremeFraction(vector<double> nums, vector<double> dens) {
@@ -246,16 +448,54 @@ double esutils::ExtremeFraction::eval(double floor, double ceil) const {
 	return min(max(floor, val), ceil);
 }
 
+namespace {
+	//!< (1-x)^n given x, n*x and n already evaluated
+	double one_minus_xn(double x, double nx, double n) {
+		if (x<1 && nx<0.0001)
+			return max(0.0, min(1-nx, 1.0));
+		if (x<0.1 && nx>5)
+			return exp(-1*nx);
+		return max(0.0, min(1.0, pow(1-x, n)));
+	}
+}
+
 double esutils::OneMinusXN(const esutils::ExtremeFraction& ef_x, 
 	const esutils::ExtremeFraction& ef_n) {
 	
 	esutils::ExtremeFraction ef_nx = ef_x;
 	ef_nx.multiply(ef_n);
-	double x=ef_x.eval(), nx=ef_nx.eval();
-	//cout<<"nx: " << nx<<endl;
-	if (x<1 && nx<0.0001)
-		return max(0.0, min(1-nx, 1.0));
-	if (x<0.1 && nx>5)
-		return exp(-1*nx);
-	return max(0.0, min(1.0, pow(1-x, ef_n.eval())));
+	return one_minus_xn(ef_x.eval(), ef_nx.eval(), ef_n.eval());
+}
+
+esutils::LogFraction::LogFraction(vector<double> nums, vector<double> dens): log_value(0) {
+	for(auto num: nums)
+		multiply (num);
+	for(auto den: dens)
+		divide (den);
+}
+
+void esutils::LogFraction::multiply(double val) {
+	assert(val>0);
+	log_value += std::log(val);
+}
+
+void esutils::LogFraction::divide(double val) {
+	assert(val>0);
+	log_value -= std::log(val);
+}
+
+double esutils::LogFraction::eval(double floor, double ceil) const {
+	if(log_value>=std::log(ceil))
+		return ceil;
+	if(log_value<=std::log(floor))
+		return floor;
+	return min(max(floor, std::exp(log_value)), ceil);
+}
+
+double esutils::OneMinusXN(const esutils::LogFraction& lf_x, 
+	const esutils::LogFraction& lf_n) {
+
+	esutils::LogFraction lf_nx = lf_x;
+	lf_nx.multiply(lf_n);
+	return one_minus_xn(lf_x.eval(), lf_nx.eval(), lf_n.eval());
 }
\ No newline at end of file
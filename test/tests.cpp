@@ -5,6 +5,7 @@
 #include "utils.h"
 #include "query.h"
 #include "application.h"
+#include "discrimination_tree.h"
 
 #include <tuple>
 #include <iostream>
@@ -32,6 +33,11 @@ void test_application();
 void test_cost_model();
 void test_plan();
 void test_utils();
+void test_parser();
+void test_discrimination_tree();
+void test_containment();
+void test_statistics();
+void test_sample_estimator();
 void run_experiment_es(double wt_storage);
 
 int main(int argc, char** argv) {
@@ -45,6 +51,11 @@ int main(int argc, char** argv) {
 	// test_cost_model();
 	// test_application();
 	// test_plan();
+	// test_parser();
+	// test_discrimination_tree();
+	// test_containment();
+	// test_statistics();
+	// test_sample_estimator();
 
 	assert(argc>=3);
 	if(strcmp(argv[1], "es")==0)
@@ -119,6 +130,117 @@ void test_utils() {
 
 	n.divide(ne);
 	cout<<ne*(1-OneMinusXN(x, n))<<endl;		
+
+	// log-domain fractions agree with ExtremeFraction on random products, clamping included
+	double max_rel_error = 0, max_abs_error = 0;
+	for(int t=0; t<1000; t++) {
+		ExtremeFraction ef_x, ef_n;
+		LogFraction lf_x, lf_n;
+		for(int i=rand()%12; i>0; i--) {
+			double val = pow(10.0, (rand()%2000)/100.0-10);
+			if(rand()%2) {
+				ef_x.multiply(val); lf_x.multiply(val);
+			}
+			else {
+				ef_x.divide(val); lf_x.divide(val);
+			}
+		}
+		for(int i=rand()%4; i>0; i--) {
+			double val = 1+rand()%100000;
+			ef_n.multiply(val); lf_n.multiply(val);
+		}
+		double ef_val = ef_x.eval(), lf_val = lf_x.eval();
+		max_rel_error = max(max_rel_error, abs(ef_val-lf_val)/ef_val);
+		if(ef_val<=1)  // probabilities are only defined for x in (0, 1]
+			max_abs_error = max(max_abs_error, abs(OneMinusXN(ef_x, ef_n)-OneMinusXN(lf_x, lf_n)));
+	}
+	bool agree = max_rel_error<1e-12 && max_abs_error<1e-12;
+	cout<<"LogFraction "<<(agree ? "agrees" : "disagrees")<<" with ExtremeFraction"<<endl;
+
+	// bitsets behave like std::set on random sets, including elements beyond the first word
+	bool same = true;
+	set<set<uint>> sets;
+	set<BitSet> bitsets;
+	for(int t=0; t<1000; t++) {
+		set<uint> s1, s2;
+		BitSet b1, b2;
+		uint range = (t%2 ? 16 : 150);
+		for(int i=rand()%8; i>0; i--) {
+			uint ele = rand()%range;
+			s1.insert(ele); b1.insert(ele);
+		}
+		for(int i=rand()%8; i>0; i--) {
+			uint ele = rand()%range;
+			s2.insert(ele); b2.insert(ele);
+		}
+		same = same && set_intersection_size(s1, s2)==set_intersection_size(b1, b2);
+		same = same && (s1<s2)==(b1<b2) && (s1==s2)==(b1==b2);
+		sets.insert(s1);
+		bitsets.insert(b1);
+		set_difference_inplace(s1, s2);
+		set_difference_inplace(b1, b2);
+		same = same && s1.size()==b1.size() && std::equal(s1.begin(), s1.end(), b1.begin());
+	}
+	same = same && sets.size()==bitsets.size();
+	auto it2 = bitsets.begin();
+	for(auto it1=sets.begin(); same && it1!=sets.end(); it1++, it2++)
+		same = std::equal(it1->begin(), it1->end(), it2->begin()) && it1->size()==it2->size();
+	cout<<"BitSet "<<(same ? "agrees" : "disagrees")<<" with std::set"<<endl;
+
+	// goal bitmasks agree with the std::set versions on every subset of goals of a query
+	vector<BaseRelation> brs {{"K", {{Dtype::String, "k", 1e5}, {Dtype::Int, "d", 1e5}}, 1e7},
+								{"E", {{Dtype::String, "e", 8e4}, {Dtype::Int, "d", 1e5}}, 8e6},
+								{"C", {{Dtype::String, "e", 8e4}, {Dtype::String, "c", 10}}, 1e5} };
+	map<std::string, const BaseRelation*> name2br {{"K", &brs[0]}, {"E", &brs[1]}, {"C", &brs[2]}};
+	Expression expr("Q[k1, k2](e) :- K(k1, d); K(k2, d); E(e, d); C(e, str_phone); E(str_3, d2); K(k3, d2)", name2br);
+	auto bfs_connected = [&expr](const set<int>& subset_goals) {
+		set<int> reached {*subset_goals.begin()};
+		vector<int> frontier(reached.begin(), reached.end());
+		while(!frontier.empty()) {
+			int gid = frontier.back();
+			frontier.pop_back();
+			for(auto& symbol: expr.goal_at(gid).symbols)
+				if(!symbol.isconstant)
+					for(int cgid: expr.goals_containing(symbol.var))
+						if(subset_goals.count(cgid) && reached.insert(cgid).second)
+							frontier.push_back(cgid);
+		}
+		return reached.size()==subset_goals.size();
+	};
+	same = true;
+	uint num_connected = 0;
+	for(uint k=1; k<=(uint) expr.num_goals(); k++) {
+		auto subsets = generate_subsets(expr.num_goals(), k);
+		auto masks = generate_subset_masks(expr.num_goals(), k);
+		same = same && subsets.size()==masks.size();
+		for(uint i=0; same && i<subsets.size(); i++) {
+			same = set_to_mask(subsets[i])==masks[i] && mask_to_set(masks[i])==subsets[i];
+			same = same && expr.connected(masks[i])==bfs_connected(subsets[i]);
+			same = same && expr.connected(subsets[i])==bfs_connected(subsets[i]);
+			num_connected += expr.connected(masks[i]);
+		}
+	}
+	cout<<"goal masks "<<(same ? "agree" : "disagree")<<" with goal sets, "<<num_connected<<" connected subsets"<<endl;
+
+	// the connected subsets enumerated are exactly the connected ones among all subsets, each once
+	same = true;
+	for(uint max_size=1; max_size<=(uint) expr.num_goals(); max_size++) {
+		set<uint64_t> brute_force;
+		for(uint k=1; k<=max_size; k++)
+			for(auto& subset: generate_subsets(expr.num_goals(), k))
+				if(expr.connected(subset))
+					brute_force.insert(set_to_mask(subset));
+		auto subsets = expr.connected_subsets(max_size);
+		set<uint64_t> enumerated;
+		uint64_t subset;
+		uint num_enumerated = 0;
+		while(subsets.next(subset)) {
+			enumerated.insert(subset);
+			num_enumerated++;
+		}
+		same = same && enumerated==brute_force && num_enumerated==enumerated.size();
+	}
+	cout<<"connected subsets "<<(same ? "agree" : "disagree")<<" with brute force"<<endl;
 }
 
 void test_expression() {
@@ -328,6 +450,7 @@ void test_subcores() {
 		"v4[M](D, C, S) :- car(M, D); loc(D, C); part(S, M, C)",
 		"v5[D](S, C) :- car(M, D); part(S, M, C)"
 	};
+	list<Index> indexes;
 	for(string index_str: index_strs) {
 		Expression index_expr(index_str, name2br);
 		Index index(index_expr);
@@ -337,7 +460,57 @@ void test_subcores() {
 		for(auto vt: query.get_view_tuples(index))
 			cout<<vt.show()<<endl;
 		cout<<endl<<endl;
+
+		indexes.push_back(index);
+		for(auto headvar: index_expr.head_vars()) 
+			if(index_expr.head_vars().size()>1) {
+				Expression variant = index_expr;
+				variant.drop_headvar(headvar);
+				indexes.push_back(Index(variant));
+			}
+	}
+
+	// evaluating the indexes and their variants together gives the same view tuples
+	vector<const Index*> index_ptrs;
+	for(const auto& index: indexes)
+		index_ptrs.push_back(&index);
+	uint num_bodies;
+	auto batch_vts = query.get_view_tuples(index_ptrs, &num_bodies);
+	bool same = true;
+	for(uint i=0; i<index_ptrs.size(); i++) {
+		auto vts = query.get_view_tuples(*index_ptrs[i]);
+		same = same && vts.size()==batch_vts[i].size();
+		for(auto it1=vts.begin(), it2=batch_vts[i].begin(); same && it1!=vts.end(); it1++, it2++)
+			same = (it1->show()==it2->show());
+	}
+	cout<<"Batch evaluation of "<<index_ptrs.size()<<" indexes over "<<num_bodies<<" bodies: ";
+	cout<<(same ? "same" : "different")<<" view tuples"<<endl;
+
+	// swapping M1 and M2 in vs2 gives the same view tuple, so only one of (m1, m2) and (m2, m1) is 
+	// generated. vs3 has no such automorphism: its images are priced differently against a plan 
+	// holding one of the goals, and both are generated, as are the ones of vs1
+	Query symmetric_query(Expression("qs[m1, m2](D) :- car(m1, D); car(m2, D)", name2br), 1);
+	cout<<symmetric_query.expression().show()<<endl;
+	Query::Body symmetric_body(symmetric_query.expression());
+	cout<<symmetric_body.isomorphisms(symmetric_body, Query::max_automorphisms).size()<<" automorphisms"<<endl;
+	for(string index_str: {"vs1[M](D) :- car(M, D)", "vs2[M1, M2](D) :- car(M1, D); car(M2, D)", 
+		"vs3[M1](M2, D) :- car(M1, D); car(M2, D)"}) {
+		Index index(Expression(index_str, name2br));
+		for(auto vt: symmetric_query.get_view_tuples(index))
+			cout<<vt.show(false)<<endl;
 	}
+
+	// view tuples mapped onto a query with an isomorphic body are the ones generated for it
+	Query renamed_query(Expression("qr[n2, n1](E) :- car(n2, E); car(n1, E)", name2br), 1);
+	Query::Isomorphism iso;
+	cout<<"isomorphic: "<<symmetric_query.find_isomorphism(renamed_query, iso)<<endl;
+	Index index(Expression("vs3[M1](M2, D) :- car(M1, D); car(M2, D)", name2br));
+	set<string> mapped_vts, renamed_vts;
+	for(auto vt: symmetric_query.get_view_tuples(index))
+		mapped_vts.insert(ViewTuple(vt, renamed_query, iso).show(false));
+	for(auto vt: renamed_query.get_view_tuples(index))
+		renamed_vts.insert(vt.show(false));
+	cout<<mapped_vts.size()<<" mapped view tuples, "<<(mapped_vts==renamed_vts ? "same" : "different")<<" as generated"<<endl;
 }
 
 vector<vector<Data>> generate_random_data(int num_tuples,
@@ -371,6 +544,16 @@ void test_application() {
 
 	Application app(vector<Query>{Q}, 4);
 	app.show_candidates();
+	cout<<filter_counters().show()<<endl;
+	cout<<containment_cache().show()<<endl;
+	size_t cache_size = containment_cache().size();
+	unsigned long cache_lookups = containment_cache().hits()+containment_cache().misses();
+	auto matrix = app.index_containment_matrix(1);
+	auto matrix_parallel = app.index_containment_matrix(4);
+	cout<<matrix.size()<<" candidates, "<<matrix.count()<<" containments, same in parallel: "
+		<<(matrix.show()==matrix_parallel.show())<<endl;
+	cout<<"cache untouched by the matrix: "<<(containment_cache().size()==cache_size 
+		&& containment_cache().hits()+containment_cache().misses()==cache_lookups)<<endl;
 	auto design_ub=app.optimize_wsc_standalone(true);
 	auto design_lb=app.optimize_wsc_standalone(false);
 	cout<<design_ub.show()<<endl;
@@ -404,6 +587,27 @@ void test_cost_model() {
 	for(uint i=0; i<varids.size(); i++)
 		cout<<varnames[i]<<": "<<cards[i]<<", ";
 	cout<<endl;
+	bool same_cards = (E.get_cardinalities(varids)==cards);
+	cout<<"repeated: "<<(same_cards ? "same" : "different")<<" cardinalities, "<<E.num_memo_hits()
+		<<" of "<<E.num_memo_lookups()<<" lookups memoized"<<endl;
+	// components are merged as goals are added, in whatever order they come
+	CardinalityEstimator E_incremental{expr, {}};
+	for(int gid=3; gid>=0; gid--) {
+		E_incremental.add_goal(gid);
+		E_incremental.get_cardinalities({expr.name_to_var("e")});
+	}
+	vector<double> incremental_cards = E_incremental.get_cardinalities(varids);
+	bool close = true;
+	for(uint i=0; i<varids.size(); i++)
+		close = close && abs(incremental_cards[i]-cards[i])<=1e-9*cards[i];
+	cout<<"goals added in reverse: "<<(close ? "same" : "different")<<" cardinalities"<<endl;
+
+	// a body with a cycle, a pendant path and a goal whose only variable is e, split at each variable
+	Expression split_expr("Qs[k1](c) :- K(k1, d); K(k2, d); E(e, d); C(e, str_email); E(e2, d2); K(k2, d2); C(e2, c)", name2br);
+	CardinalityEstimator E_split(split_expr);
+	for(auto var: split_expr.vars())
+		cout<<split_expr.var_to_name(var)<<": "<<E_split.get_cardinalities({var})[0]<<", ";
+	cout<<endl;
 
 	Index inv{{"INV[k](d) :- K(k, d)", name2br}};
 	cout<<inv.storage_cost()<<" "<<inv.avg_block_size()<<endl;
@@ -439,6 +643,12 @@ void test_cost_model() {
 	cout<<"time: "<<P.time(dinv_vt)<<endl;
 	P.append(inv_vt2);
 	cout<<"time: "<<P.time(dinv_vt)<<endl;
+	vector<const ViewTuple*> candidates {&einv_vt1, &dinv_vt, &einv_vt2};
+	auto batch_times = P.time(candidates);
+	bool same_times = true;
+	for(uint i=0; i<candidates.size(); i++)
+		same_times = same_times && batch_times[i]==P.time(candidates[i]);
+	cout<<"batch: "<<(same_times ? "same" : "different")<<" times"<<endl;
 	P.append(dinv_vt);
 	cout<<"time: "<<P.time(dinv_vt)<<endl;
 
@@ -527,10 +737,448 @@ void test_plan() {
 }
 
 
+void test_parser() {
+	cout<<"--------------------Start test_parser()-------------------------\n\n";
+	vector<BaseRelation> brs {{"K", {{Dtype::String, "k", 1e5}, {Dtype::Int, "d", 1e5}}, 1e7},
+								{"E", {{Dtype::String, "e", 8e4}, {Dtype::Int, "d", 1e5}}, 8e6},
+								{"C", {{Dtype::String, "e", 8e4}, {Dtype::String, "c", 10}}, 1e5} };
+	map<std::string, const BaseRelation*> name2br {{"K", &brs[0]}, {"E", &brs[1]}, {"C", &brs[2]}};
+
+	vector<string> exprs {
+		"Qent[k1, k2](d, e) :- K(k1, d); K(k2, d); E(e, d); C(e, str_phone)",
+		"Q[k1, k2](d) :- K(k1, d); K(k2, d);",
+		"Q[](d) :- K(str_a, d); K(k2, int_-3)",
+		"Q[k1](d) :- K(k1, d); K(k2, int_3",
+		"Q[k1](d) :- K(k1, d); L(k2, d)",
+		"Q[k1](d, e) :- K(k1, d)",
+		"Q[k1](d) :- K(k1, d, e)",
+		"Q[k1](d) :- K(k1, int_3x)",
+		"Q[k1](d) - K(k1, d)"
+	};
+	vector<Expression::ParseError> errors;
+	for(auto& expr: Expression::parse_batch(exprs, name2br, errors, 4))
+		cout<<expr.show();
+	for(auto& error: errors)
+		cout<<error.show()<<endl;
+
+	string filename = "temp/workload.txt";
+	FILE* file = fopen(filename.c_str(), "w");
+	if(file==NULL) {
+		cout<<"could not create "<<filename<<endl;
+		return;
+	}
+	fprintf(file, "# keyword queries\n");
+	for(int i=0; i<1000; i++)
+		fprintf(file, "Q%d[k1, k2](d) :- K(k1, d); K(k2, d); K(str_kw%d, d)\n", i, i);
+	fprintf(file, "\nQbad[k1](d) :- K(k1, d); C(k1, d)\n");
+	fclose(file);
+	errors.clear();
+	clock_t begin = clock();
+	auto workload = Expression::parse_workload(filename, name2br, errors);
+	cout<<"parsed "<<workload.size()<<" expressions in "
+		<<double(clock()-begin)/CLOCKS_PER_SEC<<" cpu seconds\n";
+	cout<<workload.back().show();
+	for(auto& error: errors)
+		cout<<error.show()<<endl;
+}
+
+
+void test_discrimination_tree() {
+	cout<<"--------------------Start test_discrimination_tree()-------------------------\n\n";
+	vector<BaseRelation> brs {{"car", {{Dtype::Int, "Make", 1}, {Dtype::String, "Dealer", 1}}, 1},
+								{"loc", {{Dtype::String, "Dealer", 1}, {Dtype::Int, "City", 1}}, 1},
+								{"part", {{Dtype::Int, "Store", 1}, {Dtype::Int, "Make", 1}, {Dtype::Int, "City", 1}}, 1} };
+	map<std::string, const BaseRelation*> name2br {{"car", &brs[0]}, {"loc", &brs[1]}, {"part", &brs[2]}};
+
+	vector<Expression> candidates {
+		{"v1[M](D, C) :- car(M, D); loc(D, C)", name2br},
+		{"v2[S](M, C) :- part(S, M, C)", name2br},
+		{"v3[](S) :- car(M, str_anderson); loc(str_anderson, C); part(S, M, C)", name2br},
+		{"v4[M](D, C, S) :- car(M, D); loc(D, C); part(S, M, C)", name2br},
+		{"v5[D](S, C) :- car(M, D); part(S, M, C)", name2br},
+		{"v6[](S) :- car(M, str_smith); part(S, M, C)", name2br},
+		{"v7[S](M) :- part(S, M, M)", name2br}
+	};
+	DiscriminationTree<string> tree;
+	for(auto& exp: candidates)
+		tree.insert(&exp, exp.get_name());
+
+	Expression query("q1[S](C) :- car(M, str_anderson); loc(str_anderson, C); part(S, M, C)", name2br);
+	cout<<"may map into "<<query.show();
+	for(auto name: tree.find_mapping_into(query))
+		cout<<name<<" ";
+	cout<<endl;
+	cout<<"may contain "<<query.show();
+	for(auto name: tree.find_containing(query))
+		cout<<name<<" ";
+	cout<<endl;
+
+	Expression v1_copy("w1[M](D2, C2) :- loc(D2, C2); car(M, D2)", name2br);
+	cout<<"may be isomorphic to "<<v1_copy.show();
+	for(auto name: tree.find_isomorphic(v1_copy))
+		cout<<name<<" ";
+	cout<<endl;
+}
+
+namespace {
+
+/**checks that var2symb maps every variable of src, every goal of src onto a goal of dest, free and 
+bound head variables onto head variables of the same kind and the head variables of src onto all 
+the head variables of dest*/
+bool valid_containment_map(const Expression& src, const Expression& dest, const map<int, Symbol>& var2symb) {
+	for(int var: src.vars())
+		if(var2symb.find(var)==var2symb.end())
+			return false;
+	for(int gid=0; gid<src.num_goals(); gid++) {
+		Expression::Goal goal = src.goal_at(gid);
+		for(auto& symbol: goal.symbols)
+			if(!symbol.isconstant)
+				symbol = var2symb.at(symbol.var);
+		bool found = false;
+		for(int dgid=0; !found && dgid<dest.num_goals(); dgid++)
+			found = goal==dest.goal_at(dgid);
+		if(!found) return false;
+	}
+	set<int> covered;
+	for(int var: src.head_vars()) {
+		auto& symbol = var2symb.at(var);
+		if(symbol.isconstant) return false;
+		if(src.is_free_headvar(var) && !dest.is_free_headvar(symbol.var)) return false;
+		if(src.is_bound_headvar(var) && !dest.is_bound_headvar(symbol.var)) return false;
+		covered.insert(symbol.var);
+	}
+	return covered==dest.head_vars();
+}
+
+/**tries every assignment of the goals of src to goals of dest*/
+bool brute_force_containment(const Expression& src, const Expression& dest) {
+	vector<int> assignment(src.num_goals(), 0);
+	while(true) {
+		map<int, Symbol> var2symb;
+		bool consistent = true;
+		for(int gid=0; consistent && gid<src.num_goals(); gid++) {
+			auto& symbols = src.goal_at(gid).symbols;
+			auto& dest_goal = dest.goal_at(assignment[gid]);
+			consistent = src.goal_at(gid).br==dest_goal.br;
+			for(uint i=0; consistent && i<symbols.size(); i++)
+				if(symbols[i].isconstant)
+					consistent = symbols[i]==dest_goal.symbols[i];
+				else
+					consistent = var2symb.emplace(symbols[i].var, dest_goal.symbols[i]).first->second==dest_goal.symbols[i];
+		}
+		if(consistent && valid_containment_map(src, dest, var2symb))
+			return true;
+		int gid = 0;
+		while(gid<src.num_goals() && ++assignment[gid]==dest.num_goals())
+			assignment[gid++] = 0;
+		if(gid==src.num_goals()) return false;
+	}
+}
 
+}
 
+void test_containment() {
+	cout<<"--------------------Start test_containment()-------------------------\n\n";
+	vector<BaseRelation> brs {{"R", {{Dtype::Int, "a", 1}, {Dtype::Int, "b", 1}}, 1},
+								{"S", {{Dtype::Int, "a", 1}}, 1} };
+	map<std::string, const BaseRelation*> name2br {{"R", &brs[0]}, {"S", &brs[1]}};
+
+	// (source, destination, whether there is a containment map)
+	vector<std::tuple<string, string, bool>> pairs {
+		std::make_tuple("A[](x) :- R(x, y); R(y, z)", "B[](x) :- R(x, x)", true),
+		std::make_tuple("B[](x) :- R(x, x)", "A[](x) :- R(x, y); R(y, z)", false),
+		std::make_tuple("C[](x) :- R(x, int_1)", "D[](x) :- R(x, int_1); S(x)", true),
+		std::make_tuple("C[](x) :- R(x, int_1)", "E[](x) :- R(x, int_2)", false),
+		std::make_tuple("F[](x) :- R(x, y)", "C[](x) :- R(x, int_1)", true),
+		std::make_tuple("C[](x) :- R(x, int_1)", "F[](x) :- R(x, y)", false),
+		std::make_tuple("G[x](y) :- R(x, y)", "H[x](y) :- R(x, y); R(y, y)", true),
+		std::make_tuple("G[x](y) :- R(x, y)", "I[y](x) :- R(x, y)", false),
+		std::make_tuple("J[](x) :- R(x, y); S(y)", "K[](x, y) :- R(x, y); S(y)", false),
+		std::make_tuple("P[](a) :- R(a, b); R(b, c); R(c, d)", "T[](a) :- R(a, b); R(b, c); R(c, a)", true),
+		std::make_tuple("T[](a) :- R(a, b); R(b, c); R(c, a)", "P[](a) :- R(a, b); R(b, c); R(c, d)", false)
+	};
+	bool correct = true;
+	for(auto& pair: pairs) {
+		Expression src(std::get<0>(pair), name2br), dest(std::get<1>(pair), name2br);
+		auto cmap = find_containment_map(&src, &dest);
+		correct = correct && cmap.empty()!=std::get<2>(pair);
+		correct = correct && (cmap.empty() || valid_containment_map(src, dest, cmap.var_map()));
+	}
+	cout<<"known pairs "<<(correct ? "correct" : "incorrect")<<endl;
+
+	// random bodies with repeated variables and constants against brute force
+	std::default_random_engine generator(11);
+	auto random_expression = [&generator, &name2br](const string& name) {
+		vector<string> heads {"[](x)", "[x]()", "[]()"}, symbols {"x", "y", "z", "w", "int_1", "int_2"};
+		std::uniform_int_distribution<int> num_goals(1, 4), symbol(0, symbols.size()-1), head(0, heads.size()-1);
+		string result = name+heads[head(generator)]+" :- ";
+		for(int gid=num_goals(generator); gid>0; gid--) {
+			// every body contains x so that the head is safe
+			string first = (result.back()==' ' ? "x" : symbols[symbol(generator)]);
+			if(symbol(generator)%2)
+				result += "R("+first+", "+symbols[symbol(generator)]+")";
+			else
+				result += "S("+first+")";
+			if(gid>1) result += "; ";
+		}
+		return Expression(result, name2br);
+	};
+	uint num_contained = 0;
+	correct = true;
+	for(int t=0; t<2000; t++) {
+		Expression src = random_expression("Q1"), dest = random_expression("Q2");
+		auto cmap = find_containment_map(&src, &dest);
+		num_contained += !cmap.empty();
+		correct = correct && cmap.empty()!=brute_force_containment(src, dest);
+		correct = correct && containment_map_exists(&src, &dest)!=cmap.empty();
+		correct = correct && (cmap.empty() || valid_containment_map(src, dest, cmap.var_map()));
+	}
+	cout<<"random pairs "<<(correct ? "agree" : "disagree")<<" with brute force, "
+		<<num_contained<<" contained"<<endl;
+
+	// each filter rejects the pairs it is meant for
+	vector<std::tuple<string, string, std::atomic<unsigned long> FilterCounters::*>> rejected {
+		std::make_tuple("L[](x) :- R(x, y); S(y)", "M[](x) :- R(x, y); R(y, x)", &FilterCounters::relations),
+		std::make_tuple("C[](x) :- R(x, int_1)", "E[](x) :- R(x, int_2)", &FilterCounters::constants),
+		std::make_tuple("F[](x) :- R(x, y)", "N[](x, y) :- R(x, y)", &FilterCounters::head_vars),
+		std::make_tuple("G[x](y) :- R(x, y)", "X[x, y]() :- R(x, y)", &FilterCounters::head_vars),
+		std::make_tuple("B[](x) :- R(x, x)", "A[](x) :- R(x, y); R(y, z)", &FilterCounters::goal_patterns),
+		std::make_tuple("C[](x) :- R(x, int_1)", "W[](x) :- R(x, y); S(int_1)", &FilterCounters::goal_patterns)
+	};
+	correct = true;
+	for(auto& pair: rejected) {
+		Expression src(std::get<0>(pair), name2br), dest(std::get<1>(pair), name2br);
+		filter_counters().reset();
+		correct = correct && !may_contain(&src, &dest) && (filter_counters().*std::get<2>(pair))==1;
+		filter_counters().reset();
+		correct = correct && !may_be_isomorphic(&src, &dest) && !isomorphic(&src, &dest);
+		correct = correct && filter_counters().searches==0;
+	}
+	cout<<"filters "<<(correct ? "reject" : "miss")<<" their pairs"<<endl;
+
+	// the filters never reject a pair with a containment map, or an isomorphic pair
+	filter_counters().reset();
+	uint num_rejected = 0;
+	correct = true;
+	for(int t=0; t<2000; t++) {
+		Expression exp1 = random_expression("Q1"), exp2 = random_expression("Q2");
+		bool contained = brute_force_containment(exp1, exp2);
+		bool iso = contained && brute_force_containment(exp2, exp1);
+		if(!may_contain(&exp1, &exp2)) {
+			num_rejected++;
+			correct = correct && !contained;
+		}
+		correct = correct && (may_be_isomorphic(&exp1, &exp2) || !iso);
+		correct = correct && isomorphic(&exp1, &exp2)==iso;
+	}
+	cout<<"filters "<<(correct ? "sound" : "unsound")<<" on random pairs, rejected "<<num_rejected<<endl;
+	cout<<filter_counters().show()<<endl;
+
+	// repeated lookups hit the cache instead of searching again
+	Expression exp1("A[](x) :- R(x, y); R(y, z)", name2br), exp2("B[](x) :- R(x, x)", name2br);
+	Expression exp3("C[](x) :- R(x, int_1)", name2br), exp4("D[](x) :- R(x, int_1); S(x)", name2br);
+	containment_cache().clear();
+	filter_counters().reset();
+	correct = true;
+	for(int t=0; t<3; t++)
+		correct = correct && !find_containment_map(&exp1, &exp2).empty();
+	correct = correct && containment_cache().hits()==2 && containment_cache().misses()==1;
+	correct = correct && filter_counters().searches==1;
+	cout<<"repeated lookups "<<(correct ? "hit" : "miss")<<" the cache"<<endl;
+
+	// the least recently used entry is evicted at capacity
+	ContainmentCache cache(2);
+	bool result;
+	map<int, Symbol> var2symb;
+	cache.insert(&exp1, &exp2, ContainmentCache::Kind::Containment, false, var2symb);
+	cache.insert(&exp3, &exp4, ContainmentCache::Kind::Containment, false, var2symb);
+	cache.lookup(&exp1, &exp2, ContainmentCache::Kind::Containment, result, var2symb);
+	cache.insert(&exp2, &exp1, ContainmentCache::Kind::Containment, false, var2symb);
+	correct = cache.size()==2;
+	correct = correct && cache.lookup(&exp1, &exp2, ContainmentCache::Kind::Containment, result, var2symb);
+	correct = correct && !cache.lookup(&exp3, &exp4, ContainmentCache::Kind::Containment, result, var2symb);
+	correct = correct && cache.lookup(&exp2, &exp1, ContainmentCache::Kind::Containment, result, var2symb);
+	cout<<"least recently used entry "<<(correct ? "evicted" : "kept")<<endl;
+
+	// peeks find entries without refreshing them or counting hits and misses
+	ContainmentCache peeked_cache(2);
+	peeked_cache.insert(&exp1, &exp2, ContainmentCache::Kind::Containment, false, var2symb);
+	peeked_cache.insert(&exp3, &exp4, ContainmentCache::Kind::Containment, false, var2symb);
+	correct = peeked_cache.peek(&exp1, &exp2, ContainmentCache::Kind::Containment, result, var2symb) && !result;
+	correct = correct && !peeked_cache.peek(&exp2, &exp1, ContainmentCache::Kind::Containment, result, var2symb);
+	peeked_cache.insert(&exp2, &exp1, ContainmentCache::Kind::Containment, false, var2symb);
+	correct = correct && !peeked_cache.peek(&exp1, &exp2, ContainmentCache::Kind::Containment, result, var2symb);
+	correct = correct && peeked_cache.peek(&exp3, &exp4, ContainmentCache::Kind::Containment, result, var2symb);
+	correct = correct && peeked_cache.hits()==0 && peeked_cache.misses()==0;
+	cout<<"peeks "<<(correct ? "leave" : "change")<<" the cache"<<endl;
+
+	// with no key bits every pair collides, and entries are only returned for their own expressions
+	ContainmentCache colliding_cache(4, true, 0);
+	map<int, Symbol> map12 = find_containment_map(&exp1, &exp2).var_map();
+	colliding_cache.insert(&exp1, &exp2, ContainmentCache::Kind::Containment, true, map12);
+	correct = !colliding_cache.lookup(&exp3, &exp4, ContainmentCache::Kind::Containment, result, var2symb);
+	correct = correct && !colliding_cache.lookup(&exp1, &exp2, ContainmentCache::Kind::Isomorphism, result, var2symb);
+	correct = correct && colliding_cache.lookup(&exp1, &exp2, ContainmentCache::Kind::Containment, result, var2symb);
+	correct = correct && result && var2symb==map12;
+	colliding_cache.insert(&exp3, &exp4, ContainmentCache::Kind::Isomorphism, false, map<int, Symbol>());
+	correct = correct && colliding_cache.size()==1;
+	correct = correct && !colliding_cache.lookup(&exp1, &exp2, ContainmentCache::Kind::Containment, result, var2symb);
+	correct = correct && colliding_cache.lookup(&exp3, &exp4, ContainmentCache::Kind::Isomorphism, result, var2symb);
+	correct = correct && !result;
+	cout<<"colliding keys "<<(correct ? "resolved" : "confused")<<endl;
+}
 
+void test_statistics() {
+	cout<<"--------------------Start test_statistics()-------------------------\n\n";
+	// keywords follow a Zipf distribution over 1000 keywords, documents are uniform
+	std::default_random_engine generator(7);
+	vector<double> weights;
+	for(int k=1; k<=1000; k++)
+		weights.push_back(1.0/k);
+	std::discrete_distribution<int> keyword(weights.begin(), weights.end());
+	std::uniform_int_distribution<int> document(0, 4999);
+	vector<vector<Data>> tuples;
+	map<int, int> keyword_counts;
+	map<int, set<int>> keyword_documents;
+	set<int> documents;
+	for(int i=0; i<20000; i++) {
+		int k = keyword(generator), d = document(generator);
+		tuples.push_back({k, d});
+		keyword_counts[k]++;
+		keyword_documents[k].insert(d);
+		documents.insert(d);
+	}
 
+	BaseRelation K("K", {{Dtype::Int, "k", 1000}, {Dtype::Int, "d", 5000}}, 20000);
+	K.analyze(tuples);
+	cout<<K.show()<<endl;
+	cout<<K.statistics_at(0).show()<<endl;
+	auto within = [](double estimate, double actual, double tolerance) {
+		return std::abs(estimate-actual)<=tolerance*actual;
+	};
+	cout<<"distinct keywords: "<<within(K.card_at(0), keyword_counts.size(), 0.05)
+		<<", distinct documents: "<<within(K.card_at(1), documents.size(), 0.05)<<endl;
+	cout<<"most common keyword: "<<(K.statistics_at(0).most_common.at(0).first==Data(0))
+		<<", its count: "<<within(K.value_count(0, Data(0)), keyword_counts[0], 0.05)<<endl;
+	cout<<"rare keyword count: "<<within(K.value_count(0, Data(900)), keyword_counts[900], 2)<<endl;
+
+	// documents containing a frequent keyword outnumber those containing a rare one
+	map<std::string, const BaseRelation*> name2br {{"K", &K}};
+	Expression hot("Qh[](d) :- K(int_0, d)", name2br), cold("Qc[](d) :- K(int_900, d)", name2br);
+	double hot_docs = CardinalityEstimator(hot).get_cardinalities({hot.name_to_var("d")})[0];
+	double cold_docs = CardinalityEstimator(cold).get_cardinalities({cold.name_to_var("d")})[0];
+	cout<<"documents of the frequent keyword: "<<within(hot_docs, keyword_documents[0].size(), 0.1)
+		<<", of the rare keyword: "<<within(cold_docs, keyword_documents[900].size(), 2)<<endl;
+
+	// each document draws its keywords, with repetitions, from the 50 keywords of one of 20 topics
+	vector<vector<Data>> topic_tuples;
+	map<int, set<int>> document_keywords;
+	std::uniform_int_distribution<int> topic_keyword(0, 49);
+	for(int d=0; d<2000; d++)
+		for(int i=0; i<30; i++) {
+			int k = (d%20)*50 + topic_keyword(generator);
+			topic_tuples.push_back({k, d});
+			document_keywords[d].insert(k);
+		}
+	double keyword_documents_pairs = 0;
+	for(auto& kv: document_keywords)
+		keyword_documents_pairs += kv.second.size();
+	BaseRelation Kind("K", {{Dtype::Int, "k", 1000}, {Dtype::Int, "d", 2000}}, 60000);
+	BaseRelation Kjoint = Kind;
+	Kind.analyze(topic_tuples);
+	Kjoint.analyze(topic_tuples, true);
+	// an inverted index stores each distinct (keyword, document) pair once
+	for(auto br: {&Kind, &Kjoint}) {
+		map<std::string, const BaseRelation*> name2K {{"K", br}};
+		Expression inv("INV[k](d) :- K(k, d)", name2K);
+		double inv_entries = 1;
+		for(auto card: CardinalityEstimator(inv).get_cardinalities({inv.name_to_var("k"), inv.name_to_var("d")}))
+			inv_entries *= card;
+		cout<<(br==&Kind ? "independent" : "joint")<<" columns, index entries: "
+			<<within(inv_entries, keyword_documents_pairs, 0.05)<<endl;
+	}
 
+	// an empty relation still gives positive estimates
+	BaseRelation Kempty("K", {{Dtype::Int, "k", 1000}, {Dtype::Int, "d", 5000}}, 20000);
+	Kempty.analyze({}, true);
+	map<std::string, const BaseRelation*> name2Kempty {{"K", &Kempty}};
+	Expression empty_exp("Q[k](d) :- K(k, d); K(int_3, d)", name2Kempty);
+	auto empty_cards = CardinalityEstimator(empty_exp).get_cardinalities({empty_exp.name_to_var("k")});
+	cout<<"empty relation: "<<Kempty.num_tuples()<<" tuple, cardinality "<<empty_cards[0]<<endl;
+}
 
+void test_sample_estimator() {
+	cout<<"--------------------Start test_sample_estimator()-------------------------\n\n";
+	std::default_random_engine generator(11);
+	std::uniform_int_distribution<int> keyword(0, 499), document(0, 1999);
+	vector<vector<Data>> tuples;
+	map<int, set<int>> document_keywords;
+	map<int, int> document_counts;
+	for(int i=0; i<20000; i++) {
+		int k = keyword(generator), d = document(generator);
+		tuples.push_back({k, d});
+		document_keywords[d].insert(k);
+		document_counts[d]++;
+	}
+	double join_tuples = 0, keyword_documents_pairs = 0;
+	set<pair<int, int>> keyword_pairs;
+	for(auto& kv: document_counts)
+		join_tuples += kv.second*kv.second;
+	for(auto& kv: document_keywords) {
+		keyword_documents_pairs += kv.second.size();
+		for(auto k1: kv.second)
+			for(auto k2: kv.second)
+				keyword_pairs.insert(make_pair(k1, k2));
+	}
 
+	// a 20% sample of K in random order
+	BaseRelation K("K", {{Dtype::Int, "k", 500}, {Dtype::Int, "d", 2000}}, 20000);
+	std::shuffle(tuples.begin(), tuples.end(), generator);
+	BaseRelation::Table sample(&K, "kd");
+	for(int i=0; i<4000; i++)
+		sample.df.add_tuple(tuples[i]);
+	SampleEstimator sampler({{&K, &sample}}, 10);
+
+	map<std::string, const BaseRelation*> name2br {{"K", &K}};
+	Expression join("J[k1](k2, d) :- K(k1, d); K(k2, d)", name2br);
+	auto result = sampler.execute(join);
+	auto num_tuples = sampler.num_tuples(*result);
+	auto num_pairs = sampler.num_distinct(*result, {join.name_to_var("k1"), join.name_to_var("k2")});
+	cout<<"join tuples in interval: "<<(num_tuples.low<=join_tuples && join_tuples<=num_tuples.high)
+		<<", within 10%: "<<(std::abs(num_tuples.value-join_tuples)<=0.1*join_tuples)<<endl;
+	cout<<"keyword pairs in interval: "<<(num_pairs.low<=keyword_pairs.size() && keyword_pairs.size()<=num_pairs.high)
+		<<", within 25%: "<<(std::abs(num_pairs.value-keyword_pairs.size())<=0.25*keyword_pairs.size())<<endl;
+
+	// rows sharing a base tuple are correlated, so the intervals of the join count must account for it 
+	// to cover it in about 95% of the samples
+	uint covering = 0, num_samples = 20;
+	for(uint r=0; r<num_samples; r++) {
+		std::shuffle(tuples.begin(), tuples.end(), generator);
+		BaseRelation::Table other_sample(&K, "kd");
+		for(int i=0; i<2000; i++)
+			other_sample.df.add_tuple(tuples[i]);
+		SampleEstimator other_sampler({{&K, &other_sample}}, 10);
+		auto estimate = other_sampler.num_tuples(*other_sampler.execute(join));
+		covering += (estimate.low<=join_tuples && join_tuples<=estimate.high);
+	}
+	cout<<"join intervals covering the count in at least 19 of "<<num_samples<<" samples: "<<(covering>=19)<<endl;
+
+	// index storage costs are estimated over the sample through the cardinality estimators
+	Expression inv("INV[k](d) :- K(k, d)", name2br);
+	vector<int> inv_vars {inv.name_to_var("k"), inv.name_to_var("d")};
+	double sampled_entries = 1;
+	for(auto card: CardinalityEstimator(inv, &sampler).get_cardinalities(inv_vars))
+		sampled_entries *= card;
+	cout<<"sampled index entries within 10%: "
+		<<(std::abs(sampled_entries-keyword_documents_pairs)<=0.1*keyword_documents_pairs)<<endl;
+	double exact_storage = mem_storage_weight*500 + disk_storage_weight*keyword_documents_pairs;
+	double sampled_storage = Index(inv, &sampler).storage_cost();
+	cout<<"sampled index storage cost within 10%: "
+		<<(std::abs(sampled_storage-exact_storage)<=0.1*exact_storage)<<endl;
+
+	// too sparse a sample falls back to the analytic estimate
+	Expression rare("Qr[](d) :- K(int_100000, d)", name2br);
+	double sparse_card = CardinalityEstimator(rare, &sampler).get_cardinalities({rare.name_to_var("d")})[0];
+	double analytic_card = CardinalityEstimator(rare).get_cardinalities({rare.name_to_var("d")})[0];
+	cout<<"sparse sample: "<<(sparse_card==analytic_card ? "analytic" : "sampled")<<" estimate"<<endl;
+}